@@ -50,9 +50,11 @@ void x264_param_default( x264_param_t *param )
     param->i_threads = X264_THREADS_AUTO;
     param->b_deterministic = 1;
     param->i_sync_lookahead = X264_SYNC_LOOKAHEAD_AUTO;
+    param->i_lookahead_threads = X264_THREADS_AUTO;
 
     /* Video properties */
     param->i_csp           = X264_CSP_I420;
+    param->i_bitdepth      = BIT_DEPTH;
     param->i_width         = 0;
     param->i_height        = 0;
     param->vui.i_sar_width = 0;
@@ -96,10 +98,10 @@ void x264_param_default( x264_param_t *param )
     param->rc.i_vbv_max_bitrate = 0;
     param->rc.i_vbv_buffer_size = 0;
     param->rc.f_vbv_buffer_init = 0.9;
-    param->rc.i_qp_constant = 23 + QP_BD_OFFSET;
+    param->rc.i_qp_constant = -1;
     param->rc.f_rf_constant = 23;
     param->rc.i_qp_min = 0;
-    param->rc.i_qp_max = QP_MAX;
+    param->rc.i_qp_max = INT_MAX;
     param->rc.i_qp_step = 4;
     param->rc.f_ip_factor = 1.4;
     param->rc.f_pb_factor = 1.3;
@@ -429,14 +431,12 @@ int x264_param_apply_profile( x264_param_t *param, const char *profile )
     if( !profile )
         return 0;
 
-#if BIT_DEPTH > 8
-    if( !strcasecmp( profile, "baseline" ) || !strcasecmp( profile, "main" ) ||
-        !strcasecmp( profile, "high" ) )
+    if( param->i_bitdepth > 8 && (!strcasecmp( profile, "baseline" ) || !strcasecmp( profile, "main" ) ||
+                                  !strcasecmp( profile, "high" )) )
     {
-        x264_log( NULL, X264_LOG_ERROR, "%s profile doesn't support a bit depth of %d.\n", profile, BIT_DEPTH );
+        x264_log( NULL, X264_LOG_ERROR, "%s profile doesn't support a bit depth of %d.\n", profile, param->i_bitdepth );
         return -1;
     }
-#endif
 
     if( !strcasecmp( profile, "baseline" ) )
     {
@@ -470,8 +470,8 @@ int x264_param_apply_profile( x264_param_t *param, const char *profile )
         x264_log( NULL, X264_LOG_ERROR, "invalid profile: %s\n", profile );
         return -1;
     }
-    if( (param->rc.i_rc_method == X264_RC_CQP && param->rc.i_qp_constant <= 0) ||
-        (param->rc.i_rc_method == X264_RC_CRF && (int)(param->rc.f_rf_constant + QP_BD_OFFSET) <= 0) )
+    if( (param->rc.i_rc_method == X264_RC_CQP && param->rc.i_qp_constant != -1 && param->rc.i_qp_constant <= 0) ||
+        (param->rc.i_rc_method == X264_RC_CRF && (int)(param->rc.f_rf_constant + 6*(param->i_bitdepth-8)) <= 0) )
     {
         x264_log( NULL, X264_LOG_ERROR, "%s profile doesn't support lossless\n", profile );
         return -1;
@@ -610,6 +610,15 @@ int x264_param_parse( x264_param_t *p, const char *name, const char *value )
         else
             p->i_sync_lookahead = atoi(value);
     }
+    OPT("low-memory")
+        p->b_low_memory = atobool(value);
+    OPT("lookahead-threads")
+    {
+        if( !strcmp(value, "auto") )
+            p->i_lookahead_threads = X264_THREADS_AUTO;
+        else
+            p->i_lookahead_threads = atoi(value);
+    }
     OPT2("deterministic", "n-deterministic")
         p->b_deterministic = atobool(value);
     OPT2("level", "level-idc")
@@ -645,6 +654,8 @@ int x264_param_parse( x264_param_t *p, const char *name, const char *value )
         p->vui.i_chroma_loc = atoi(value);
         b_error = ( p->vui.i_chroma_loc < 0 || p->vui.i_chroma_loc > 5 );
     }
+    OPT("output-depth")
+        p->i_bitdepth = atoi(value);
     OPT("fps")
     {
         if( sscanf( value, "%u/%u", &p->i_fps_num, &p->i_fps_den ) == 2 )
@@ -821,6 +832,10 @@ int x264_param_parse( x264_param_t *p, const char *name, const char *value )
 #endif
     OPT("dump-yuv")
         p->psz_dump_yuv = strdup(value);
+    OPT("frame-log")
+        p->psz_frame_log = strdup(value);
+    OPT("frame-log-format")
+        b_error |= parse_enum( value, x264_frame_log_format_names, &p->i_frame_log_format );
     OPT2("analyse", "partitions")
     {
         p->analyse.inter = 0;
@@ -906,6 +921,8 @@ int x264_param_parse( x264_param_t *p, const char *name, const char *value )
         p->rc.f_rf_constant_max = atof(value);
     OPT("rc-lookahead")
         p->rc.i_lookahead = atoi(value);
+    OPT("lookahead-pyramid")
+        p->rc.i_lookahead_pyramid = atoi(value);
     OPT2("qpmin", "qp-min")
         p->rc.i_qp_min = atoi(value);
     OPT2("qpmax", "qp-max")
@@ -1087,26 +1104,57 @@ void x264_picture_clean( x264_picture_t *pic )
 /****************************************************************************
  * x264_malloc:
  ****************************************************************************/
+/* Every allocation carries a header with what x264_free needs, which also
+ * lets us keep a running total for x264_memory_usage.  The header size keeps
+ * the returned pointer 16-byte aligned. */
+typedef struct
+{
+    void *buf;
+    intptr_t size;
+} x264_malloc_header_t;
+#define MALLOC_HEADER_SIZE 16
+
+static volatile intptr_t memory_current;
+static volatile intptr_t memory_peak;
+
+#if HAVE_THREAD && defined(__GNUC__) && (__GNUC__ > 4 || __GNUC__ == 4 && __GNUC_MINOR__ >= 1)
+#define memory_add( x ) __sync_add_and_fetch( &memory_current, x )
+#define memory_cas( ptr, old, new ) __sync_bool_compare_and_swap( ptr, old, new )
+#else
+/* without atomics the totals can drift slightly when threaded */
+#define memory_add( x ) (memory_current += (x))
+#define memory_cas( ptr, old, new ) (*(ptr) = (new), 1)
+#endif
+
 void *x264_malloc( int i_size )
 {
     uint8_t *align_buf = NULL;
 #if SYS_MACOSX || (SYS_WINDOWS && ARCH_X86_64)
     /* Mac OS X and Win x64 always returns 16 byte aligned memory */
-    align_buf = malloc( i_size );
+    uint8_t *buf = align_buf = malloc( i_size + MALLOC_HEADER_SIZE );
 #elif HAVE_MALLOC_H
-    align_buf = memalign( 16, i_size );
+    uint8_t *buf = align_buf = memalign( 16, i_size + MALLOC_HEADER_SIZE );
 #else
-    uint8_t *buf = malloc( i_size + 15 + sizeof(void **) );
+    uint8_t *buf = malloc( i_size + 15 + MALLOC_HEADER_SIZE );
     if( buf )
     {
-        align_buf = buf + 15 + sizeof(void **);
+        align_buf = buf + 15;
         align_buf -= (intptr_t) align_buf & 15;
-        *( (void **) ( align_buf - sizeof(void **) ) ) = buf;
     }
 #endif
     if( !align_buf )
+    {
         x264_log( NULL, X264_LOG_ERROR, "malloc of size %d failed\n", i_size );
-    return align_buf;
+        return NULL;
+    }
+    x264_malloc_header_t *header = (x264_malloc_header_t*)align_buf;
+    header->buf = buf;
+    header->size = i_size;
+    intptr_t current = memory_add( i_size );
+    intptr_t peak = memory_peak;
+    while( current > peak && !memory_cas( &memory_peak, peak, current ) )
+        peak = memory_peak;
+    return align_buf + MALLOC_HEADER_SIZE;
 }
 
 /****************************************************************************
@@ -1116,14 +1164,22 @@ void x264_free( void *p )
 {
     if( p )
     {
-#if HAVE_MALLOC_H || SYS_MACOSX || (SYS_WINDOWS && ARCH_X86_64)
-        free( p );
-#else
-        free( *( ( ( void **) p ) - 1 ) );
-#endif
+        x264_malloc_header_t *header = (x264_malloc_header_t*)((uint8_t*)p - MALLOC_HEADER_SIZE);
+        memory_add( -header->size );
+        free( header->buf );
     }
 }
 
+/****************************************************************************
+ * x264_memory_usage:
+ ****************************************************************************/
+int64_t x264_memory_usage( int64_t *peak )
+{
+    if( peak )
+        *peak = memory_peak;
+    return memory_current;
+}
+
 /****************************************************************************
  * x264_reduce_fraction:
  ****************************************************************************/
@@ -1202,7 +1258,7 @@ char *x264_param2string( x264_param_t *p, int b_res )
         s += sprintf( s, "%dx%d ", p->i_width, p->i_height );
         s += sprintf( s, "fps=%u/%u ", p->i_fps_num, p->i_fps_den );
         s += sprintf( s, "timebase=%u/%u ", p->i_timebase_num, p->i_timebase_den );
-        s += sprintf( s, "bitdepth=%d ", BIT_DEPTH );
+        s += sprintf( s, "bitdepth=%d ", p->i_bitdepth );
     }
 
     s += sprintf( s, "cabac=%d", p->b_cabac );
@@ -1257,6 +1313,8 @@ char *x264_param2string( x264_param_t *p, int b_res )
 
     if( p->rc.b_mb_tree || p->rc.i_vbv_buffer_size )
         s += sprintf( s, " rc_lookahead=%d", p->rc.i_lookahead );
+    if( p->rc.i_lookahead_pyramid )
+        s += sprintf( s, " lookahead_pyramid=%d", p->rc.i_lookahead_pyramid );
 
     s += sprintf( s, " rc=%s mbtree=%d", p->rc.i_rc_method == X264_RC_ABR ?
                                ( p->rc.b_stat_read ? "2pass" : p->rc.i_vbv_max_bitrate == p->rc.i_bitrate ? "cbr" : "abr" )
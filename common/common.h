@@ -58,6 +58,7 @@ do {\
 #define X264_THREAD_MAX 128
 #define X264_PCM_COST (384*BIT_DEPTH+16)
 #define X264_LOOKAHEAD_MAX 250
+#define X264_LOOKAHEAD_THREAD_MAX 16
 #define QP_BD_OFFSET (6*(BIT_DEPTH-8))
 #define QP_MAX_SPEC (51+QP_BD_OFFSET)
 #define QP_MAX (QP_MAX_SPEC+18)
@@ -129,7 +130,9 @@ typedef union { x264_uint128_t i; uint64_t a[2]; uint32_t b[4]; uint16_t c[8]; u
 #   define MPIXEL_X4(src) M32(src)
 #endif
 
+#ifndef BIT_DEPTH
 #define BIT_DEPTH X264_BIT_DEPTH
+#endif
 
 #define CPPIXEL_X4(dst,src) MPIXEL_X4(dst) = MPIXEL_X4(src)
 
@@ -196,6 +199,34 @@ char *x264_slurp_file( const char *filename );
 /* mdate: return the current date in microsecond */
 int64_t x264_mdate( void );
 
+#if HAVE_TIMING
+/* timer_read: a cheap monotonic counter in unspecified units,
+ * converted to microseconds by x264_encoder_timing */
+static ALWAYS_INLINE int64_t x264_timer_read( void )
+{
+#if HAVE_X86_INLINE_ASM
+    uint32_t lo, hi;
+    asm volatile( "rdtsc" : "=a"(lo), "=d"(hi) );
+    return ((uint64_t)hi << 32) | lo;
+#else
+    return x264_mdate();
+#endif
+}
+
+/* TIMER_STOP restarts the timer, so consecutive stages can share one */
+#define TIMER_START( var ) int64_t var = x264_timer_read()
+#define TIMER_STOP( h, stage, var )\
+do {\
+    int64_t timer_now = x264_timer_read();\
+    (h)->timing.i_time[stage] += timer_now - var;\
+    (h)->timing.i_count[stage]++;\
+    var = timer_now;\
+} while( 0 )
+#else
+#define TIMER_START( var )
+#define TIMER_STOP( h, stage, var )
+#endif
+
 /* x264_param2string: return a (malloced) string containing most of
  * the encoding options */
 char *x264_param2string( x264_param_t *p, int b_res );
@@ -203,6 +234,8 @@ char *x264_param2string( x264_param_t *p, int b_res );
 /* log */
 void x264_log( x264_t *h, int i_level, const char *psz_fmt, ... );
 
+x264_t *x264_encoder_open_api( x264_param_t *param, void *api );
+
 void x264_reduce_fraction( uint32_t *n, uint32_t *d );
 void x264_reduce_fraction64( uint64_t *n, uint64_t *d );
 void x264_cavlc_init( void );
@@ -378,6 +411,8 @@ typedef struct
 
 } x264_slice_header_t;
 
+typedef struct x264_lowres_threads_t x264_lowres_threads_t;
+
 typedef struct x264_lookahead_t
 {
     volatile uint8_t              b_exit_thread;
@@ -390,21 +425,29 @@ typedef struct x264_lookahead_t
     x264_sync_frame_list_t        ifbuf;
     x264_sync_frame_list_t        next;
     x264_sync_frame_list_t        ofbuf;
+    x264_lowres_threads_t         *lowres_threads;
+    int16_t                       (*pyramid_mvs[2])[2]; /* coarse search results, one per 8x8 block of each level */
 } x264_lookahead_t;
 
 typedef struct x264_ratecontrol_t   x264_ratecontrol_t;
+typedef struct x264_frame_log_t     x264_frame_log_t;
 
 struct x264_t
 {
     /* encoder parameters */
     x264_param_t    param;
+    void            *api; /* handle given to nalu_process if not NULL, see x264_encoder_open_api */
 
     x264_t          *thread[X264_THREAD_MAX+1];
     int             b_thread_active;
+    int             b_metrics_active; /* psnr/ssim of the last frame are still being measured on metricspool */
     int             i_thread_phase; /* which thread to use for the next frame */
     int             i_threadslice_start; /* first row in this thread slice */
     int             i_threadslice_end; /* row after the end of this thread slice */
+    int             i_mv_range_thread; /* vertical lag behind the reference frames' threads for the current frame */
+    int             b_mv_range_thread_adapt; /* lower i_mv_range_thread per frame according to lowres motion */
     x264_threadpool_t *threadpool;
+    x264_threadpool_t *metricspool; /* measures psnr/ssim of finished frames when frame-threaded */
 
     /* bitstream output */
     struct
@@ -626,6 +669,7 @@ struct x264_t
 
          /* buffer for weighted versions of the reference frames */
         pixel *p_weight_buf[X264_REF_MAX];
+        int   *p_weight_sums; /* block sums for x264_weights_analyse */
 
         /* current value */
         int     i_type;
@@ -761,6 +805,9 @@ struct x264_t
     /* rate control encoding only */
     x264_ratecontrol_t *rc;
 
+    /* per-frame statistics log, NULL if disabled */
+    x264_frame_log_t *framelog;
+
     /* stats */
     struct
     {
@@ -785,6 +832,9 @@ struct x264_t
             int i_mb_pred_mode[4][13];
             /* Adaptive direct mv pred */
             int i_direct_score[2];
+            /* Time spent waiting on reference frame threads, in microseconds */
+            int i_stall_time;
+            int i_stall_ref[2][X264_REF_MAX*2];
             /* Metrics */
             int64_t i_ssd[3];
             double f_ssim;
@@ -817,9 +867,19 @@ struct x264_t
         int     i_direct_frames[2];
         /* num p-frames weighted */
         int     i_wpred[2];
+        /* frame thread stalls */
+        int     i_stall_frames;
+        int64_t i_stall_time;
+        int64_t i_stall_ref[2][X264_REF_MAX*2];
+        int64_t i_mv_range_thread;
 
     } stat;
 
+    /* per-thread stage timing, in x264_timer_read units; summed by x264_encoder_timing */
+    x264_timing_t timing;
+    int64_t i_timer_start;
+    int64_t i_mdate_start;
+
     /* 0 = luma 4x4, 1 = luma 8x8, 2 = chroma 4x4 */
     udctcoef (*nr_offset)[64];
     uint32_t (*nr_residual_sum)[64];
@@ -61,6 +61,7 @@ const x264_cpu_name_t x264_cpu_names[] =
     {"SSE4.1",  X264_CPU_MMX|X264_CPU_MMXEXT|X264_CPU_SSE|X264_CPU_SSE2|X264_CPU_SSE3|X264_CPU_SSSE3|X264_CPU_SSE4},
     {"SSE4.2",  X264_CPU_MMX|X264_CPU_MMXEXT|X264_CPU_SSE|X264_CPU_SSE2|X264_CPU_SSE3|X264_CPU_SSSE3|X264_CPU_SSE4|X264_CPU_SSE42},
     {"AVX", X264_CPU_AVX},
+    {"AVX2", X264_CPU_AVX|X264_CPU_AVX2},
     {"Cache32", X264_CPU_CACHELINE_32},
     {"Cache64", X264_CPU_CACHELINE_64},
     {"SSEMisalign", X264_CPU_SSE_MISALIGN},
@@ -103,6 +104,7 @@ uint32_t x264_cpu_detect( void )
     uint32_t cpu = 0;
     uint32_t eax, ebx, ecx, edx;
     uint32_t vendor[4] = {0};
+    uint32_t max_basic_cap;
     uint32_t max_extended_cap;
     int cache;
 
@@ -112,7 +114,8 @@ uint32_t x264_cpu_detect( void )
 #endif
 
     x264_cpu_cpuid( 0, &eax, vendor+0, vendor+2, vendor+1 );
-    if( eax == 0 )
+    max_basic_cap = eax;
+    if( max_basic_cap == 0 )
         return 0;
 
     x264_cpu_cpuid( 1, &eax, &ebx, &ecx, &edx );
@@ -141,6 +144,13 @@ uint32_t x264_cpu_detect( void )
             cpu |= X264_CPU_AVX;
     }
 
+    if( (cpu&X264_CPU_AVX) && max_basic_cap >= 7 )
+    {
+        x264_cpu_cpuid( 7, &eax, &ebx, &ecx, &edx );
+        if( ebx&0x00000020 )
+            cpu |= X264_CPU_AVX2;
+    }
+
     if( cpu & X264_CPU_SSSE3 )
         cpu |= X264_CPU_SSE2_IS_FAST;
     if( cpu & X264_CPU_SSE4 )
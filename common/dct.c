@@ -517,6 +517,11 @@ void x264_dct_init( int cpu, x264_dct_function_t *dctf )
         dctf->sub8x8_dct8      = x264_sub8x8_dct8_avx;
         dctf->sub16x16_dct8    = x264_sub16x16_dct8_avx;
     }
+
+    /* The other transforms are built on the 4-wide TRANSPOSE/DCT4_1D macros,
+     * which have no 256-bit versions yet. */
+    if( cpu&X264_CPU_AVX2 )
+        dctf->add16x16_idct_dc = x264_add16x16_idct_dc_avx2;
 #endif //HAVE_MMX
 
 #if HAVE_ALTIVEC
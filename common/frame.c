@@ -42,6 +42,65 @@ static int align_plane_size( int x, int disalign )
     return x;
 }
 
+/* The per-frame analysis and planning arrays share one allocation.  Called with a NULL
+ * buffer it only returns the size, otherwise it points the arrays into it.
+ * Only the (b-p0, p1-b) pairs the lookahead can reach get an entry:
+ * p1-p0 never exceeds i_bframe+1, and b == p0 only for the intra cost. */
+static int frame_analysis_layout( x264_t *h, x264_frame_t *frame, uint8_t *buf, int b_fdec )
+{
+    int i_mb_count = h->mb.i_mb_count;
+    int i_rows = h->mb.i_mb_height;
+    int i_bframe = h->param.i_bframe;
+    int size = 0;
+#define CARVE( var, bytes )\
+    {\
+        if( buf )\
+            var = (void*)(buf + size);\
+        size += ALIGN( bytes, 64 );\
+    }
+
+    if( b_fdec )
+    {
+        CARVE( frame->i_row_satds[0][0], i_rows * sizeof(int) );
+        CARVE( frame->i_row_satd, i_rows * sizeof(int) );
+        return size;
+    }
+    /* plans can't be longer than the lookahead's frame list */
+    int i_planned = X264_MIN( h->frames.i_delay+3, X264_LOOKAHEAD_MAX ) + 1;
+    CARVE( frame->f_planned_cpb_duration, i_planned * sizeof(double) );
+    CARVE( frame->i_planned_satd, i_planned * sizeof(int) );
+    CARVE( frame->i_planned_type, i_planned * sizeof(uint8_t) );
+    /* VBV planning reads these before the lookahead has filled them in */
+    if( buf )
+        memset( buf, 0, size );
+    if( !h->frames.b_have_lowres )
+        return size;
+    CARVE( frame->i_row_satds[0][0], i_rows * sizeof(int) );
+    CARVE( frame->lowres_costs[0][0], (i_mb_count+3) * sizeof(uint16_t) );
+    for( int i = 1; i <= i_bframe+1; i++ )
+        for( int j = 0; i+j <= i_bframe+1; j++ )
+        {
+            CARVE( frame->lowres_costs[i][j], (i_mb_count+3) * sizeof(uint16_t) );
+            CARVE( frame->i_row_satds[i][j], i_rows * sizeof(int) );
+        }
+    for( int j = 0; j <= !!i_bframe; j++ )
+        for( int i = 0; i <= i_bframe; i++ )
+        {
+            CARVE( frame->lowres_mvs[j][i], 2*(i_mb_count+3) * sizeof(int16_t) );
+            if( buf )
+                memset( frame->lowres_mvs[j][i], 0, 2*(i_mb_count+3) * sizeof(int16_t) );
+            CARVE( frame->lowres_mv_costs[j][i], i_mb_count * sizeof(int) );
+        }
+    CARVE( frame->i_propagate_cost, (i_mb_count+3) * sizeof(uint16_t) );
+    if( h->param.analyse.i_weighted_pred )
+        CARVE( frame->i_lowres_block_sum, i_mb_count * sizeof(int) );
+    if( h->param.rc.b_mb_tree && i_bframe )
+        for( int j = 0; j < 2; j++ )
+            CARVE( frame->i_propagate_out[j], i_mb_count * sizeof(uint16_t) );
+#undef CARVE
+    return size;
+}
+
 x264_frame_t *x264_frame_new( x264_t *h, int b_fdec )
 {
     x264_frame_t *frame;
@@ -72,10 +131,6 @@ x264_frame_t *x264_frame_new( x264_t *h, int b_fdec )
     frame->i_lines_lowres = frame->i_lines[0]/2;
     frame->i_stride_lowres = align_stride( frame->i_width_lowres + 2*PADH, align, disalign<<1 );
 
-    for( int i = 0; i < h->param.i_bframe + 2; i++ )
-        for( int j = 0; j < h->param.i_bframe + 2; j++ )
-            CHECKED_MALLOC( frame->i_row_satds[i][j], i_lines/16 * sizeof(int) );
-
     frame->i_poc = -1;
     frame->i_type = X264_TYPE_AUTO;
     frame->i_qpplus1 = X264_QP_AUTO;
@@ -137,6 +192,8 @@ x264_frame_t *x264_frame_new( x264_t *h, int b_fdec )
             frame->mv[1]  = NULL;
             frame->ref[1] = NULL;
         }
+        CHECKED_MALLOC( frame->buffer_analysis, frame_analysis_layout( h, frame, NULL, 1 ) );
+        frame_analysis_layout( h, frame, frame->buffer_analysis, 1 );
         CHECKED_MALLOC( frame->i_row_bits, i_lines/16 * sizeof(int) );
         CHECKED_MALLOC( frame->f_row_qp, i_lines/16 * sizeof(float) );
         if( h->param.analyse.i_me_method >= X264_ME_ESA )
@@ -148,6 +205,8 @@ x264_frame_t *x264_frame_new( x264_t *h, int b_fdec )
     }
     else /* fenc frame */
     {
+        CHECKED_MALLOC( frame->buffer_analysis, frame_analysis_layout( h, frame, NULL, 0 ) );
+        frame_analysis_layout( h, frame, frame->buffer_analysis, 0 );
         if( h->frames.b_have_lowres )
         {
             luma_plane_size = align_plane_size( frame->i_stride_lowres * (frame->i_lines[0]/2 + 2*PADV), disalign );
@@ -156,16 +215,15 @@ x264_frame_t *x264_frame_new( x264_t *h, int b_fdec )
             for( int i = 0; i < 4; i++ )
                 frame->lowres[i] = frame->buffer_lowres[0] + (frame->i_stride_lowres * PADV + PADH) + i * luma_plane_size;
 
-            for( int j = 0; j <= !!h->param.i_bframe; j++ )
-                for( int i = 0; i <= h->param.i_bframe; i++ )
-                {
-                    CHECKED_MALLOCZERO( frame->lowres_mvs[j][i], 2*h->mb.i_mb_count*sizeof(int16_t) );
-                    CHECKED_MALLOC( frame->lowres_mv_costs[j][i], h->mb.i_mb_count*sizeof(int) );
-                }
-            CHECKED_MALLOC( frame->i_propagate_cost, (i_mb_count+3) * sizeof(uint16_t) );
-            for( int j = 0; j <= h->param.i_bframe+1; j++ )
-                for( int i = 0; i <= h->param.i_bframe+1; i++ )
-                    CHECKED_MALLOC( frame->lowres_costs[j][i], (i_mb_count+3) * sizeof(uint16_t) );
+            for( int i = 0; i < h->param.rc.i_lookahead_pyramid; i++ )
+            {
+                frame->i_width_pyramid[i] = (frame->i_width_lowres + (2<<i) - 1) >> (i+1);
+                frame->i_lines_pyramid[i] = (frame->i_lines_lowres + (2<<i) - 1) >> (i+1);
+                frame->i_stride_pyramid[i] = align_stride( frame->i_width_pyramid[i] + 2*PADH, align, disalign<<1 );
+                CHECKED_MALLOC( frame->buffer_pyramid[i], frame->i_stride_pyramid[i] * (frame->i_lines_pyramid[i] + 2*PADV) * sizeof(pixel) );
+                frame->lowres_pyramid[i] = frame->buffer_pyramid[i] + frame->i_stride_pyramid[i] * PADV + PADH;
+            }
+
             frame->i_intra_cost = frame->lowres_costs[0][0];
             memset( frame->i_intra_cost, -1, (i_mb_count+3) * sizeof(uint16_t) );
         }
@@ -201,19 +259,9 @@ void x264_frame_delete( x264_frame_t *frame )
             x264_free( frame->buffer[i] );
         for( int i = 0; i < 4; i++ )
             x264_free( frame->buffer_lowres[i] );
-        for( int i = 0; i < X264_BFRAME_MAX+2; i++ )
-            for( int j = 0; j < X264_BFRAME_MAX+2; j++ )
-                x264_free( frame->i_row_satds[i][j] );
-        for( int j = 0; j < 2; j++ )
-            for( int i = 0; i <= X264_BFRAME_MAX; i++ )
-            {
-                x264_free( frame->lowres_mvs[j][i] );
-                x264_free( frame->lowres_mv_costs[j][i] );
-            }
-        x264_free( frame->i_propagate_cost );
-        for( int j = 0; j <= X264_BFRAME_MAX+1; j++ )
-            for( int i = 0; i <= X264_BFRAME_MAX+1; i++ )
-                x264_free( frame->lowres_costs[j][i] );
+        for( int i = 0; i < 2; i++ )
+            x264_free( frame->buffer_pyramid[i] );
+        x264_free( frame->buffer_analysis );
         x264_free( frame->f_qp_offset );
         x264_free( frame->f_qp_offset_aq );
         x264_free( frame->i_inv_qscale_factor );
@@ -404,6 +452,9 @@ void x264_frame_expand_border_lowres( x264_frame_t *frame )
 {
     for( int i = 0; i < 4; i++ )
         plane_expand_border( frame->lowres[i], frame->i_stride_lowres, frame->i_width_lowres, frame->i_lines_lowres, PADH, PADV, 1, 1, 0 );
+    for( int i = 0; i < 2 && frame->lowres_pyramid[i]; i++ )
+        plane_expand_border( frame->lowres_pyramid[i], frame->i_stride_pyramid[i], frame->i_width_pyramid[i],
+                             frame->i_lines_pyramid[i], PADH, PADV, 1, 1, 0 );
 }
 
 void x264_frame_expand_border_mod16( x264_t *h, x264_frame_t *frame )
@@ -441,12 +492,19 @@ void x264_frame_cond_broadcast( x264_frame_t *frame, int i_lines_completed )
     x264_pthread_mutex_unlock( &frame->mutex );
 }
 
-void x264_frame_cond_wait( x264_frame_t *frame, int i_lines_completed )
+/* returns the time spent blocked, in microseconds */
+int x264_frame_cond_wait( x264_frame_t *frame, int i_lines_completed )
 {
+    int64_t start = 0;
     x264_pthread_mutex_lock( &frame->mutex );
-    while( frame->i_lines_completed < i_lines_completed )
-        x264_pthread_cond_wait( &frame->cv, &frame->mutex );
+    if( frame->i_lines_completed < i_lines_completed )
+    {
+        start = x264_mdate();
+        while( frame->i_lines_completed < i_lines_completed )
+            x264_pthread_cond_wait( &frame->cv, &frame->mutex );
+    }
     x264_pthread_mutex_unlock( &frame->mutex );
+    return start ? x264_mdate() - start : 0;
 }
 
 /* list operators */
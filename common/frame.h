@@ -74,12 +74,18 @@ typedef struct x264_frame
     pixel *plane[2];
     pixel *filtered[4]; /* plane[0], H, V, HV */
     pixel *lowres[4]; /* half-size copy of input frame: Orig, H, V, HV */
+    pixel *lowres_pyramid[2]; /* quarter and eighth size copies, for the lookahead's coarse motion search */
+    int     i_stride_pyramid[2];
+    int     i_width_pyramid[2];
+    int     i_lines_pyramid[2];
     uint16_t *integral;
 
     /* for unrestricted mv we allocate more data than needed
      * allocated data are stored in buffer */
     pixel *buffer[4];
     pixel *buffer_lowres[4];
+    uint8_t *buffer_analysis; /* lowres costs, mvs and row satds, see x264_frame_new */
+    pixel *buffer_pyramid[2];
 
     x264_weight_t weight[X264_REF_MAX][3]; /* [ref_index][plane] */
     pixel *weighted[X264_REF_MAX]; /* plane[0] weighted of the reference frames */
@@ -95,7 +101,9 @@ typedef struct x264_frame
 
     /* Stored as (lists_used << LOWRES_COST_SHIFT) + (cost).
      * Doesn't need special addressing for intra cost because
-     * lists_used is guaranteed to be zero in that cast. */
+     * lists_used is guaranteed to be zero in that cast.
+     * Only [0][0] and the pairs with i >= 1, i+j <= i_bframe+1 are allocated,
+     * the same goes for i_row_satds; fdec frames only have i_row_satds[0][0]. */
     uint16_t (*lowres_costs[X264_BFRAME_MAX+2][X264_BFRAME_MAX+2]);
     #define LOWRES_COST_MASK ((1<<14)-1)
     #define LOWRES_COST_SHIFT 14
@@ -122,19 +130,31 @@ typedef struct x264_frame
     int     b_intra_calculated;
     uint16_t *i_intra_cost;
     uint16_t *i_propagate_cost;
+    /* What this frame last propagated into its references as a non-referenced
+     * B-frame.  It only depends on the reference distances and the duration
+     * ratio, so later lookahead passes reuse it while those match. */
+    uint16_t *i_propagate_out[2];
+    int     i_propagate_out_dist[2]; /* 0 if not computed */
+    float   f_propagate_out_fps;
     uint16_t *i_inv_qscale_factor;
     int     b_scenecut; /* Set to zero if the frame cannot possibly be part of a real scenecut. */
     float   f_weighted_cost_delta[X264_BFRAME_MAX+2];
     uint32_t i_pixel_sum[3];
     uint64_t i_pixel_ssd[3];
+    int     *i_lowres_block_sum; /* sums of the 8x8 lowres blocks, for weightp; [0] = -1 if not computed */
 
     /* hrd */
     x264_hrd_t hrd_timing;
 
+    /* frame log: when the frame was passed to the encoder and when it left the lookahead */
+    int64_t i_time_input;
+    int64_t i_time_encode;
+
     /* vbv */
-    uint8_t i_planned_type[X264_LOOKAHEAD_MAX+1];
-    int i_planned_satd[X264_LOOKAHEAD_MAX+1];
-    double f_planned_cpb_duration[X264_LOOKAHEAD_MAX+1];
+    /* sized by the lookahead depth, see x264_frame_new */
+    uint8_t *i_planned_type;
+    int *i_planned_satd;
+    double *f_planned_cpb_duration;
     int64_t i_coded_fields_lookahead;
     int64_t i_cpb_delay_lookahead;
 
@@ -201,7 +221,7 @@ void          x264_frame_init_lowres( x264_t *h, x264_frame_t *frame );
 void          x264_deblock_init( int cpu, x264_deblock_function_t *pf );
 
 void          x264_frame_cond_broadcast( x264_frame_t *frame, int i_lines_completed );
-void          x264_frame_cond_wait( x264_frame_t *frame, int i_lines_completed );
+int           x264_frame_cond_wait( x264_frame_t *frame, int i_lines_completed );
 
 void          x264_frame_push( x264_frame_t **list, x264_frame_t *frame );
 x264_frame_t *x264_frame_pop( x264_frame_t **list );
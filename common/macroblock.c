@@ -281,6 +281,8 @@ int x264_macroblock_cache_allocate( x264_t *h )
 
         for( int i = 0; i < numweightbuf; i++ )
             CHECKED_MALLOC( h->mb.p_weight_buf[i], luma_plane_size * sizeof(pixel) );
+        if( numweightbuf )
+            CHECKED_MALLOC( h->mb.p_weight_sums, 4 * i_mb_count * sizeof(int) );
     }
 
     return 0;
@@ -295,6 +297,7 @@ void x264_macroblock_cache_free( x264_t *h )
                 x264_free( h->mb.mvr[i][j]-1 );
     for( int i = 0; i < X264_REF_MAX; i++ )
         x264_free( h->mb.p_weight_buf[i] );
+    x264_free( h->mb.p_weight_sums );
 
     if( h->param.b_cabac )
     {
@@ -380,6 +380,23 @@ static void integral_init8v( uint16_t *sum8, int stride )
         sum8[x] = sum8[x+8*stride] - sum8[x];
 }
 
+/* 2x2 box downscale; odd source sizes repeat the last row and column */
+static void frame_init_pyramid_level( pixel *dst, int i_dst, pixel *src, int i_src,
+                                      int src_width, int src_height, int width, int height )
+{
+    for( int y = 0; y < height; y++, dst += i_dst )
+    {
+        pixel *src0 = src + X264_MIN( 2*y, src_height-1 ) * i_src;
+        pixel *src1 = src + X264_MIN( 2*y+1, src_height-1 ) * i_src;
+        for( int x = 0; x < width; x++ )
+        {
+            int x0 = 2*x;
+            int x1 = X264_MIN( 2*x+1, src_width-1 );
+            dst[x] = (src0[x0] + src0[x1] + src1[x0] + src1[x1] + 2) >> 2;
+        }
+    }
+}
+
 void x264_frame_init_lowres( x264_t *h, x264_frame_t *frame )
 {
     pixel *src = frame->plane[0];
@@ -393,12 +410,25 @@ void x264_frame_init_lowres( x264_t *h, x264_frame_t *frame )
     memcpy( src+i_stride*i_height, src+i_stride*(i_height-1), (i_width+1) * sizeof(pixel) );
     h->mc.frame_init_lowres_core( src, frame->lowres[0], frame->lowres[1], frame->lowres[2], frame->lowres[3],
                                   i_stride, frame->i_stride_lowres, frame->i_width_lowres, frame->i_lines_lowres );
+    for( int i = 0; i < h->param.rc.i_lookahead_pyramid; i++ )
+    {
+        pixel *pix = i ? frame->lowres_pyramid[i-1] : frame->lowres[0];
+        int src_stride = i ? frame->i_stride_pyramid[i-1] : frame->i_stride_lowres;
+        int src_width = i ? frame->i_width_pyramid[i-1] : frame->i_width_lowres;
+        int src_height = i ? frame->i_lines_pyramid[i-1] : frame->i_lines_lowres;
+        frame_init_pyramid_level( frame->lowres_pyramid[i], frame->i_stride_pyramid[i], pix, src_stride,
+                                  src_width, src_height, frame->i_width_pyramid[i], frame->i_lines_pyramid[i] );
+    }
     x264_frame_expand_border_lowres( frame );
 
     memset( frame->i_cost_est, -1, sizeof(frame->i_cost_est) );
+    frame->i_propagate_out_dist[0] = frame->i_propagate_out_dist[1] = 0;
 
-    for( int y = 0; y < h->param.i_bframe + 2; y++ )
-        for( int x = 0; x < h->param.i_bframe + 2; x++ )
+    frame->i_row_satds[0][0][0] = -1;
+    if( frame->i_lowres_block_sum )
+        frame->i_lowres_block_sum[0] = -1;
+    for( int y = 1; y <= h->param.i_bframe + 1; y++ )
+        for( int x = 0; x + y <= h->param.i_bframe + 1; x++ )
             frame->i_row_satds[y][x][0] = -1;
 
     for( int y = 0; y <= !!h->param.i_bframe; y++ )
@@ -447,6 +477,71 @@ static void mbtree_propagate_cost( int *dst, uint16_t *propagate_in, uint16_t *i
     }
 }
 
+/* Split each mb's propagate amount between the (up to) four mbs its mv points into,
+ * weighted by the overlap.  Parts that lie outside the frame are dropped. */
+static void mbtree_propagate_list( x264_t *h, uint16_t *ref_costs, int16_t (*mvs)[2],
+                                   int *propagate_amount, uint16_t *lowres_costs,
+                                   int bipred_weight, int mb_y, int len, int list )
+{
+    int stride = h->mb.i_mb_stride;
+    int width = h->mb.i_mb_width;
+    int height = h->mb.i_mb_height;
+
+    for( int i = 0; i < len; i++ )
+    {
+        int lists_used = lowres_costs[i] >> LOWRES_COST_SHIFT;
+        /* Don't propagate for an intra block. */
+        if( propagate_amount[i] <= 0 || !(lists_used & (1 << list)) )
+            continue;
+
+        int listamount = propagate_amount[i];
+        /* Apply bipred weighting. */
+        if( lists_used == 3 )
+            listamount = (listamount * bipred_weight + 32) >> 6;
+
+        /* Early termination for simple case of mv0. */
+        if( !M32( mvs[i] ) )
+        {
+            MBTREE_CLIP_ADD( ref_costs[mb_y*stride + i], listamount );
+            continue;
+        }
+
+        int x = mvs[i][0];
+        int y = mvs[i][1];
+        int mbx = (x>>5)+i;
+        int mby = (y>>5)+mb_y;
+        int idx0 = mbx + mby * stride;
+        int idx2 = idx0 + stride;
+        x &= 31;
+        y &= 31;
+        int idx0weight = (32-y)*(32-x);
+        int idx1weight = (32-y)*x;
+        int idx2weight = y*(32-x);
+        int idx3weight = y*x;
+
+        /* We could just clip the MVs, but pixels that lie outside the frame probably shouldn't
+         * be counted. */
+        if( mbx < width-1 && mby < height-1 && mbx >= 0 && mby >= 0 )
+        {
+            MBTREE_CLIP_ADD( ref_costs[idx0+0], (listamount*idx0weight+512)>>10 );
+            MBTREE_CLIP_ADD( ref_costs[idx0+1], (listamount*idx1weight+512)>>10 );
+            MBTREE_CLIP_ADD( ref_costs[idx2+0], (listamount*idx2weight+512)>>10 );
+            MBTREE_CLIP_ADD( ref_costs[idx2+1], (listamount*idx3weight+512)>>10 );
+        }
+        else /* Check offsets individually */
+        {
+            if( mbx < width && mby < height && mbx >= 0 && mby >= 0 )
+                MBTREE_CLIP_ADD( ref_costs[idx0+0], (listamount*idx0weight+512)>>10 );
+            if( mbx+1 < width && mby < height && mbx+1 >= 0 && mby >= 0 )
+                MBTREE_CLIP_ADD( ref_costs[idx0+1], (listamount*idx1weight+512)>>10 );
+            if( mbx < width && mby+1 < height && mbx >= 0 && mby+1 >= 0 )
+                MBTREE_CLIP_ADD( ref_costs[idx2+0], (listamount*idx2weight+512)>>10 );
+            if( mbx+1 < width && mby+1 < height && mbx+1 >= 0 && mby+1 >= 0 )
+                MBTREE_CLIP_ADD( ref_costs[idx2+1], (listamount*idx3weight+512)>>10 );
+        }
+    }
+}
+
 void x264_mc_init( int cpu, x264_mc_functions_t *pf )
 {
     pf->mc_luma   = mc_luma;
@@ -496,6 +591,7 @@ void x264_mc_init( int cpu, x264_mc_functions_t *pf )
     pf->integral_init8v = integral_init8v;
 
     pf->mbtree_propagate_cost = mbtree_propagate_cost;
+    pf->mbtree_propagate_list = mbtree_propagate_list;
 
 #if HAVE_MMX
     x264_mc_init_mmx( cpu, pf );
@@ -535,7 +631,8 @@ void x264_frame_filter( x264_t *h, x264_frame_t *frame, int mb_y, int b_end )
     /* generate integral image:
      * frame->integral contains 2 planes. in the upper plane, each element is
      * the sum of an 8x8 pixel region with top-left corner on that point.
-     * in the lower plane, 4x4 sums (needed only with --partitions p4x4). */
+     * in the lower plane, 4x4 sums (needed with --partitions p4x4, and used
+     * by --me esa as a finer elimination level). */
 
     if( frame->integral )
     {
@@ -26,6 +26,9 @@
 #ifndef X264_MC_H
 #define X264_MC_H
 
+/* Propagate costs saturate, which keeps a sum independent of the order of its terms. */
+#define MBTREE_CLIP_ADD(s,x) (s) = X264_MIN((s)+(x),(1<<16)-1)
+
 struct x264_weight_t;
 typedef void (* weight_fn_t)( pixel *, int, pixel *,int, const struct x264_weight_t *, int );
 typedef struct x264_weight_t
@@ -124,6 +127,10 @@ typedef struct
 
     void (*mbtree_propagate_cost)( int *dst, uint16_t *propagate_in, uint16_t *intra_costs,
                                    uint16_t *inter_costs, uint16_t *inv_qscales, float *fps_factor, int len );
+    /* add a row of propagate amounts to the reference mbs its list's mvs point at */
+    void (*mbtree_propagate_list)( x264_t *h, uint16_t *ref_costs, int16_t (*mvs)[2],
+                                   int *propagate_amount, uint16_t *lowres_costs,
+                                   int bipred_weight, int mb_y, int len, int list );
 } x264_mc_functions_t;
 
 void x264_mc_init( int cpu, x264_mc_functions_t *pf );
@@ -845,6 +845,10 @@ void x264_pixel_init( int cpu, x264_pixel_function_t *pixf )
         pixf->intra_sad_x3_8x8c   = x264_intra_sad_x3_8x8c_ssse3;
         pixf->intra_sad_x3_16x16  = x264_intra_sad_x3_16x16_ssse3;
     }
+    if( cpu&X264_CPU_AVX2 )
+    {
+        INIT_ADS( _avx2 );
+    }
 #endif // HAVE_MMX
 #else // !HIGH_BIT_DEPTH
 #if HAVE_MMX
@@ -1057,6 +1061,13 @@ void x264_pixel_init( int cpu, x264_pixel_function_t *pixf )
         pixf->intra_sad_x3_4x4 = x264_intra_sad_x3_4x4_avx;
         pixf->intra_sad_x3_8x8 = x264_intra_sad_x3_8x8_avx;
     }
+
+    if( cpu&X264_CPU_AVX2 )
+    {
+        pixf->ssd_nv12_core    = x264_pixel_ssd_nv12_core_avx2;
+        pixf->ssim_4x4x2_core  = x264_pixel_ssim_4x4x2_core_avx2;
+        INIT_ADS( _avx2 );
+    }
 #endif //HAVE_MMX
 
 #if HAVE_ARMV6
@@ -728,6 +728,50 @@ ADD16x16 ssse3
 INIT_AVX
 ADD16x16 avx
 
+; two rows per ymm register
+%macro IDCT_DC_STORE_AVX2 3
+    mova         xm4, [r0+%1+FDEC_STRIDE*0]
+    vinserti128   m4, m4, [r0+%1+FDEC_STRIDE*1], 1
+    mova         xm5, [r0+%1+FDEC_STRIDE*2]
+    vinserti128   m5, m5, [r0+%1+FDEC_STRIDE*3], 1
+    paddusb       m4, %2
+    paddusb       m5, %2
+    psubusb       m4, %3
+    psubusb       m5, %3
+    mova [r0+%1+FDEC_STRIDE*0], xm4
+    vextracti128 [r0+%1+FDEC_STRIDE*1], m4, 1
+    mova [r0+%1+FDEC_STRIDE*2], xm5
+    vextracti128 [r0+%1+FDEC_STRIDE*3], m5, 1
+%endmacro
+
+INIT_YMM
+cglobal add16x16_idct_dc_avx2, 2,3,8
+    vbroadcasti128 m6, [pb_idctdc_unpack]
+    vbroadcasti128 m7, [pb_idctdc_unpack2]
+    mov          r2d, 2
+.loop:
+    mova         xm0, [r1]
+    pxor         xm1, xm1
+    paddw        xm0, [pw_32]
+    psraw        xm0, 6
+    psubw        xm1, xm0
+    packuswb     xm0, xm0
+    packuswb     xm1, xm1
+    vinserti128   m0, m0, xm0, 1
+    vinserti128   m1, m1, xm1, 1
+    pshufb        m2, m0, m7
+    pshufb        m0, m6
+    pshufb        m3, m1, m7
+    pshufb        m1, m6
+    IDCT_DC_STORE_AVX2 0, m0, m1
+    IDCT_DC_STORE_AVX2 FDEC_STRIDE*4, m2, m3
+    add           r1, 16
+    add           r0, FDEC_STRIDE*8
+    dec          r2d
+    jg .loop
+    vzeroupper
+    RET
+
 %endif ; HIGH_BIT_DEPTH
 
 ;-----------------------------------------------------------------------------
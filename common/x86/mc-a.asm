@@ -679,6 +679,39 @@ AVGH  4,  8, ssse3
 AVGH  4,  4, ssse3
 AVGH  4,  2, ssse3
 
+;-----------------------------------------------------------------------------
+; avx2: two rows of 16 pixels per ymm register
+;-----------------------------------------------------------------------------
+INIT_YMM
+cglobal pixel_avg_w16_avx2
+    AVG_START
+.height_loop:
+    movu         xm0, [t2]
+    movu         xm1, [t4]
+    vinserti128   m0, m0, [t2+t3], 1
+    vinserti128   m1, m1, [t4+t5], 1
+    pavgb         m0, m1
+    movu        [t0], xm0
+    vextracti128 [t0+t1], m0, 1
+    sub          eax, 2
+    lea           t4, [t4+t5*2]
+    lea           t2, [t2+t3*2]
+    lea           t0, [t0+t1*2]
+    jg .height_loop
+    vzeroupper
+    RET
+
+%macro AVGH_AVX2 2
+cglobal pixel_avg_%1x%2_avx2
+    mov eax, %2
+    cmp dword r6m, 32
+    jne pixel_avg_weight_w%1_ssse3
+    jmp pixel_avg_w%1_avx2
+%endmacro
+
+AVGH_AVX2 16, 16
+AVGH_AVX2 16,  8
+
 %endif ;HIGH_BIT_DEPTH
 
 
@@ -41,6 +41,9 @@ deinterleave_shuf: db 0,2,4,6,8,10,12,14,1,3,5,7,9,11,13,15
 pd_16: times 4 dd 16
 pd_0f: times 4 dd 0xffff
 pf_inv256: times 4 dd 0.00390625
+pd_3:      times 4 dd 3
+pd_31:     times 4 dd 31
+pd_512:    times 4 dd 512
 
 pad10: times 8 dw    10*PIXEL_MAX
 pad20: times 8 dw    20*PIXEL_MAX
@@ -60,6 +63,7 @@ cextern pw_32
 cextern pw_00ff
 cextern pw_3fff
 cextern pw_pixel_max
+cextern pd_32
 cextern pd_ffff
 
 %macro LOAD_ADD 4
@@ -1365,6 +1369,46 @@ cglobal integral_init4v_ssse3, 3,5
     jl .loop
     REP_RET
 
+; integral buffers are only guaranteed 16-byte alignment
+INIT_YMM
+cglobal integral_init4v_avx2, 3,5
+    add     r2, r2
+    add     r0, r2
+    add     r1, r2
+    lea     r3, [r0+r2*4]
+    lea     r4, [r0+r2*8]
+    neg     r2
+.loop:
+    movu    m2, [r0+r2]
+    movu    m0, [r0+r2+8]
+    movu    m4, [r4+r2]
+    movu    m1, [r4+r2+8]
+    paddw   m0, m2
+    paddw   m1, m4
+    movu    m3, [r3+r2]
+    psubw   m1, m0
+    psubw   m3, m2
+    movu  [r0+r2], m1
+    movu  [r1+r2], m3
+    add     r2, 32
+    jl .loop
+    vzeroupper
+    RET
+
+cglobal integral_init8v_avx2, 3,3
+    add   r1, r1
+    add   r0, r1
+    lea   r2, [r0+r1*8]
+    neg   r1
+.loop:
+    movu  m0, [r2+r1]
+    psubw m0, [r0+r1]
+    movu  [r0+r1], m0
+    add   r1, mmsize
+    jl .loop
+    vzeroupper
+    RET
+
 %macro FILT8x4 7
     mova      %3, [r0+%7]
     mova      %4, [r0+r5+%7]
@@ -1462,12 +1506,59 @@ cglobal integral_init4v_ssse3, 3,5
     mova      %1, m2
 %endmacro
 
+;-----------------------------------------------------------------------------
+; avx2: unaligned loads at +1 replace palignr, which can't cross 128-bit lanes.
+; packuswb interleaves the lanes, so vpermq puts the quadwords back in order.
+;-----------------------------------------------------------------------------
+%macro FILT32x4U 4 ; dst0, dsth, dstv, dstc
+    movu      m1, [r0+r5]
+    movu      m3, [r0+r5+1]
+    pavgb     m0, m1, [r0]
+    pavgb     m2, m3, [r0+1]
+    pavgb     m1, [r0+r5*2]
+    pavgb     m3, [r0+r5*2+1]
+    pavgb     m0, m2
+    pavgb     m1, m3
+    movu      m3, [r0+r5+mmsize]
+    movu      m5, [r0+r5+mmsize+1]
+    pavgb     m2, m3, [r0+mmsize]
+    pavgb     m4, m5, [r0+mmsize+1]
+    pavgb     m3, [r0+r5*2+mmsize]
+    pavgb     m5, [r0+r5*2+mmsize+1]
+    pavgb     m2, m4
+    pavgb     m3, m5
+    psrlw     m4, m0, 8
+    psrlw     m5, m2, 8
+    pand      m0, m7
+    pand      m2, m7
+    packuswb  m0, m2
+    packuswb  m4, m5
+    vpermq    m0, m0, 0xd8
+    vpermq    m4, m4, 0xd8
+    movu    [%1], m0
+    movu    [%2], m4
+    psrlw     m4, m1, 8
+    psrlw     m5, m3, 8
+    pand      m1, m7
+    pand      m3, m7
+    packuswb  m1, m3
+    packuswb  m4, m5
+    vpermq    m1, m1, 0xd8
+    vpermq    m4, m4, 0xd8
+    movu    [%3], m1
+    movu    [%4], m4
+%endmacro
+
 ;-----------------------------------------------------------------------------
 ; void frame_init_lowres_core( uint8_t *src0, uint8_t *dst0, uint8_t *dsth, uint8_t *dstv, uint8_t *dstc,
 ;                              int src_stride, int dst_stride, int width, int height )
 ;-----------------------------------------------------------------------------
 %macro FRAME_INIT_LOWRES 1
+%if mmsize == 32
+cglobal frame_init_lowres_core_%1, 6,7,8
+%else
 cglobal frame_init_lowres_core_%1, 6,7,(12-4*(BIT_DEPTH/9))*(mmsize/16) ; 8 for HIGH_BIT_DEPTH, 12 otherwise
+%endif
 %ifdef HIGH_BIT_DEPTH
     shl   dword r6m, 1
     FIX_STRIDES r5d
@@ -1542,7 +1633,9 @@ cglobal frame_init_lowres_core_%1, 6,7,(12-4*(BIT_DEPTH/9))*(mmsize/16) ; 8 for
     psrlw     m7, 8
 .vloop:
     mov      r6d, r7m
-%ifnidn %1, mmxext
+%if mmsize == 32
+    ; the avx2 loop doesn't carry anything between iterations
+%elifnidn %1, mmxext
     mova      m0, [r0]
     mova      m1, [r0+r5]
     pavgb     m0, m1
@@ -1569,7 +1662,9 @@ cglobal frame_init_lowres_core_%1, 6,7,(12-4*(BIT_DEPTH/9))*(mmsize/16) ; 8 for
     sub       r2, mmsize
     sub       r3, mmsize
     sub       r4, mmsize
-%ifdef m8
+%if mmsize == 32
+    FILT32x4U r1, r2, r3, r4
+%elifdef m8
     FILT8x4   m0, m1, m2, m3, m10, m11, mmsize
     mova      m8, m0
     mova      m9, m1
@@ -1602,7 +1697,11 @@ cglobal frame_init_lowres_core_%1, 6,7,(12-4*(BIT_DEPTH/9))*(mmsize/16) ; 8 for
     dec    dword r8m
     jg .vloop
     ADD      rsp, 2*gprsize
+%if mmsize == 32
+    vzeroupper
+%else
     emms
+%endif
     RET
 %endmacro ; FRAME_INIT_LOWRES
 
@@ -1616,6 +1715,11 @@ INIT_XMM
 FRAME_INIT_LOWRES sse2
 %define PALIGNR PALIGNR_SSSE3
 FRAME_INIT_LOWRES ssse3
+%ifndef HIGH_BIT_DEPTH
+; only handles widths that are a multiple of 32, see mc-c.c
+INIT_YMM
+FRAME_INIT_LOWRES avx2_core
+%endif
 
 ;-----------------------------------------------------------------------------
 ; void mbtree_propagate_cost( int *dst, uint16_t *propagate_in, uint16_t *intra_costs,
@@ -1665,3 +1769,83 @@ cglobal mbtree_propagate_cost_sse2, 7,7,7
     jl .loop
     REP_RET
 
+;-----------------------------------------------------------------------------
+; void mbtree_propagate_list_internal( int16_t (*mvs)[2], int *propagate_amount, uint16_t *lowres_costs,
+;                                      int *output, int bipred_weight, int len )
+;-----------------------------------------------------------------------------
+; For each group of 4 mbs, output holds the mb offsets of the mvs (x>>5, y>>5)
+; followed by the amounts going to the top-left, top-right, bottom-left and
+; bottom-right mbs, 4 dwords each. The scatter itself is done in C.
+%macro MBTREE_PROPAGATE_LIST 1
+cglobal mbtree_propagate_list_internal_%1, 6,6,8
+    movd       m6, r4d
+    pshufd     m6, m6, 0        ; bipred_weight
+    mova       m7, [pd_31]
+.loop:
+    movu       m0, [r0]         ; mvs
+    mova       m1, m0
+    pslld      m1, 16
+    psrad      m1, 16           ; x
+    psrad      m0, 16           ; y
+    mova       m2, m1
+    mova       m3, m0
+    psrad      m2, 5
+    psrad      m3, 5
+    mova  [r3+0x00], m2
+    mova  [r3+0x10], m3
+    pand       m1, m7           ; x&31
+    pand       m0, m7           ; y&31
+
+    movq       m2, [r2]         ; lowres_costs
+    pxor       m5, m5
+    punpcklwd  m2, m5
+    psrld      m2, 14           ; lists_used
+    pcmpeqd    m2, [pd_3]
+    movu       m3, [r1]         ; propagate_amount
+    mova       m4, m3
+    pmulld     m4, m6
+    paddd      m4, [pd_32]
+    psrad      m4, 6            ; (amount * bipred_weight + 32) >> 6
+    pand       m4, m2
+    pandn      m2, m3
+    por        m2, m4           ; listamount
+
+    mova       m3, [pd_32]
+    mova       m4, m3
+    psubd      m3, m1           ; 32-x
+    psubd      m4, m0           ; 32-y
+    mova       m5, m2
+    pmulld     m5, m4           ; listamount*(32-y)
+    pmulld     m2, m0           ; listamount*y
+    mova       m0, m5
+    pmulld     m5, m3           ; listamount*(32-y)*(32-x)
+    pmulld     m0, m1           ; listamount*(32-y)*x
+    mova       m4, m2
+    pmulld     m2, m3           ; listamount*y*(32-x)
+    pmulld     m4, m1           ; listamount*y*x
+    mova       m1, [pd_512]
+    paddd      m5, m1
+    paddd      m0, m1
+    paddd      m2, m1
+    paddd      m4, m1
+    psrad      m5, 10
+    psrad      m0, 10
+    psrad      m2, 10
+    psrad      m4, 10
+    mova  [r3+0x20], m5
+    mova  [r3+0x30], m0
+    mova  [r3+0x40], m2
+    mova  [r3+0x50], m4
+    add        r0, 16
+    add        r1, 16
+    add        r2, 8
+    add        r3, 0x60
+    sub       r5d, 4
+    jg .loop
+    REP_RET
+%endmacro
+
+INIT_XMM
+MBTREE_PROPAGATE_LIST sse4
+INIT_AVX
+MBTREE_PROPAGATE_LIST avx
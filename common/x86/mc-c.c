@@ -35,7 +35,8 @@
 #define DECL_SUF( func, args )\
     void func##_mmxext args;\
     void func##_sse2 args;\
-    void func##_ssse3 args;
+    void func##_ssse3 args;\
+    void func##_avx2 args;
 
 DECL_SUF( x264_pixel_avg_16x16, ( pixel *, int, pixel *, int, pixel *, int, int ))
 DECL_SUF( x264_pixel_avg_16x8,  ( pixel *, int, pixel *, int, pixel *, int, int ))
@@ -138,9 +139,71 @@ void x264_integral_init4v_sse2( uint16_t *sum8, uint16_t *sum4, int stride );
 void x264_integral_init8v_mmx( uint16_t *sum8, int stride );
 void x264_integral_init8v_sse2( uint16_t *sum8, int stride );
 void x264_integral_init4v_ssse3( uint16_t *sum8, uint16_t *sum4, int stride );
+void x264_integral_init4v_avx2( uint16_t *sum8, uint16_t *sum4, int stride );
+void x264_integral_init8v_avx2( uint16_t *sum8, int stride );
 void x264_mbtree_propagate_cost_sse2( int *dst, uint16_t *propagate_in, uint16_t *intra_costs,
                                       uint16_t *inter_costs, uint16_t *inv_qscales, float *fps_factor, int len );
 
+#define PROPAGATE_LIST(cpu)\
+void x264_mbtree_propagate_list_internal_##cpu( int16_t (*mvs)[2], int *propagate_amount,\
+                                                uint16_t *lowres_costs, int *output,\
+                                                int bipred_weight, int len );\
+\
+static void x264_mbtree_propagate_list_##cpu( x264_t *h, uint16_t *ref_costs, int16_t (*mvs)[2],\
+                                              int *propagate_amount, uint16_t *lowres_costs,\
+                                              int bipred_weight, int mb_y, int len, int list )\
+{\
+    /* the asm does groups of 4 mbs: 2 offsets and 4 amounts each */\
+    ALIGNED_ARRAY_16( int, current,[64*6] );\
+    int stride = h->mb.i_mb_stride;\
+    int width = h->mb.i_mb_width;\
+    int height = h->mb.i_mb_height;\
+\
+    for( int i0 = 0; i0 < len; i0 += 64 )\
+    {\
+        int end = X264_MIN( i0+64, len );\
+        x264_mbtree_propagate_list_internal_##cpu( mvs+i0, propagate_amount+i0, lowres_costs+i0,\
+                                                   current, bipred_weight, end-i0 );\
+        for( int i = i0; i < end; i++ )\
+        {\
+            if( propagate_amount[i] <= 0 || !(lowres_costs[i] & (1 << (list+LOWRES_COST_SHIFT))) )\
+                continue;\
+            int *amount = current + ((i-i0)>>2)*24 + ((i-i0)&3);\
+            /* Shortcut for the simple/common case of zero MV */\
+            if( !M32( mvs[i] ) )\
+            {\
+                MBTREE_CLIP_ADD( ref_costs[mb_y*stride + i], amount[8] );\
+                continue;\
+            }\
+            int mbx = amount[0] + i;\
+            int mby = amount[4] + mb_y;\
+            int idx0 = mbx + mby * stride;\
+            int idx2 = idx0 + stride;\
+            if( mbx < width-1 && mby < height-1 && mbx >= 0 && mby >= 0 )\
+            {\
+                MBTREE_CLIP_ADD( ref_costs[idx0+0], amount[8] );\
+                MBTREE_CLIP_ADD( ref_costs[idx0+1], amount[12] );\
+                MBTREE_CLIP_ADD( ref_costs[idx2+0], amount[16] );\
+                MBTREE_CLIP_ADD( ref_costs[idx2+1], amount[20] );\
+            }\
+            else\
+            {\
+                if( mbx < width && mby < height && mbx >= 0 && mby >= 0 )\
+                    MBTREE_CLIP_ADD( ref_costs[idx0+0], amount[8] );\
+                if( mbx+1 < width && mby < height && mbx+1 >= 0 && mby >= 0 )\
+                    MBTREE_CLIP_ADD( ref_costs[idx0+1], amount[12] );\
+                if( mbx < width && mby+1 < height && mbx >= 0 && mby+1 >= 0 )\
+                    MBTREE_CLIP_ADD( ref_costs[idx2+0], amount[16] );\
+                if( mbx+1 < width && mby+1 < height && mbx+1 >= 0 && mby+1 >= 0 )\
+                    MBTREE_CLIP_ADD( ref_costs[idx2+1], amount[20] );\
+            }\
+        }\
+    }\
+}
+
+PROPAGATE_LIST(sse4)
+PROPAGATE_LIST(avx)
+
 #define MC_CHROMA(cpu)\
 void x264_mc_chroma_##cpu( pixel *dstu, pixel *dstv, int i_dst,\
                            pixel *src, int i_src,\
@@ -160,6 +223,7 @@ LOWRES(mmxext)
 LOWRES(cache32_mmxext)
 LOWRES(sse2)
 LOWRES(ssse3)
+LOWRES(avx2_core)
 
 #define PIXEL_AVG_W(width,cpu)\
 void x264_pixel_avg2_w##width##_##cpu( pixel *, int, pixel *, int, pixel *, int );
@@ -488,6 +552,25 @@ PLANE_INTERLEAVE(sse2)
 PLANE_INTERLEAVE(avx)
 #endif
 
+#if !HIGH_BIT_DEPTH
+/* The avx2 core only handles multiples of 32 pixels. Give ssse3 the remainder
+ * plus one full vector from the left edge, since it needs a width of at least 24. */
+static void x264_frame_init_lowres_core_avx2( pixel *src0, pixel *dst0, pixel *dsth, pixel *dstv, pixel *dstc,
+                                              int src_stride, int dst_stride, int width, int height )
+{
+    int w = width&31 ? (width&31) + 32 : 0;
+    if( w >= width )
+    {
+        x264_frame_init_lowres_core_ssse3( src0, dst0, dsth, dstv, dstc, src_stride, dst_stride, width, height );
+        return;
+    }
+    if( w )
+        x264_frame_init_lowres_core_ssse3( src0, dst0, dsth, dstv, dstc, src_stride, dst_stride, w, height );
+    x264_frame_init_lowres_core_avx2_core( src0+2*w, dst0+w, dsth+w, dstv+w, dstc+w,
+                                           src_stride, dst_stride, width-w, height );
+}
+#endif
+
 void x264_mc_init_mmx( int cpu, x264_mc_functions_t *pf )
 {
     if( !(cpu&X264_CPU_MMX) )
@@ -593,9 +676,13 @@ void x264_mc_init_mmx( int cpu, x264_mc_functions_t *pf )
     if( (cpu&X264_CPU_SHUFFLE_IS_FAST) && !(cpu&X264_CPU_SLOW_ATOM) )
         pf->integral_init4v = x264_integral_init4v_ssse3;
 
+    if( cpu&X264_CPU_SSE4 )
+        pf->mbtree_propagate_list = x264_mbtree_propagate_list_sse4;
+
     if( !(cpu&X264_CPU_AVX) )
         return;
 
+    pf->mbtree_propagate_list = x264_mbtree_propagate_list_avx;
     pf->load_deinterleave_8x8x2_fenc = x264_load_deinterleave_8x8x2_fenc_avx;
     pf->load_deinterleave_8x8x2_fdec = x264_load_deinterleave_8x8x2_fdec_avx;
     pf->plane_copy_interleave        = x264_plane_copy_interleave_avx;
@@ -719,13 +806,25 @@ void x264_mc_init_mmx( int cpu, x264_mc_functions_t *pf )
 
     pf->integral_init4h = x264_integral_init4h_sse4;
     pf->integral_init8h = x264_integral_init8h_sse4;
+    pf->mbtree_propagate_list = x264_mbtree_propagate_list_sse4;
 
     if( !(cpu&X264_CPU_AVX) )
         return;
 
     pf->integral_init8h = x264_integral_init8h_avx;
+    pf->mbtree_propagate_list = x264_mbtree_propagate_list_avx;
     pf->hpel_filter = x264_hpel_filter_avx;
     if( !(cpu&X264_CPU_STACK_MOD4) )
         pf->mc_chroma = x264_mc_chroma_avx;
+
+    if( !(cpu&X264_CPU_AVX2) )
+        return;
+
+    /* hpel_filter, mc_chroma, mc_weight and plane_copy keep their 128-bit versions */
+    pf->avg[PIXEL_16x16] = x264_pixel_avg_16x16_avx2;
+    pf->avg[PIXEL_16x8]  = x264_pixel_avg_16x8_avx2;
+    pf->integral_init4v = x264_integral_init4v_avx2;
+    pf->integral_init8v = x264_integral_init8v_avx2;
+    pf->frame_init_lowres_core = x264_frame_init_lowres_core_avx2;
 #endif // HIGH_BIT_DEPTH
 }
@@ -540,6 +540,79 @@ SSD_NV12 sse2
 INIT_AVX
 SSD_NV12 avx
 
+%ifndef HIGH_BIT_DEPTH
+;-----------------------------------------------------------------------------
+; avx2: 16 uv pairs per iteration.  width is only guaranteed to be a multiple
+; of 8, so an odd 16-byte chunk at the start of each row is done in xmm.
+;-----------------------------------------------------------------------------
+INIT_YMM
+cglobal pixel_ssd_nv12_core_avx2, 6,7
+    shl          r4d, 1
+    add           r0, r4
+    add           r2, r4
+    pxor          m3, m3
+    pxor          m4, m4
+    vbroadcasti128 m5, [pw_00ff]
+.loopy:
+    mov           r6, r4
+    neg           r6
+    test         r4d, 16
+    jz .loopx
+    movu         xm0, [r0+r6]
+    movu         xm1, [r2+r6]
+    psubusb      xm2, xm0, xm1
+    psubusb      xm1, xm0
+    por          xm0, xm2, xm1
+    psrlw        xm2, xm0, 8
+    pand         xm0, xm5
+    pmaddwd      xm2, xm2
+    pmaddwd      xm0, xm0
+    paddd         m3, m0
+    paddd         m4, m2
+    add           r6, 16
+    jz .nexty
+.loopx:
+    movu          m0, [r0+r6]
+    movu          m1, [r2+r6]
+    psubusb       m2, m0, m1
+    psubusb       m1, m0
+    por           m0, m2, m1
+    psrlw         m2, m0, 8
+    pand          m0, m5
+    pmaddwd       m2, m2
+    pmaddwd       m0, m0
+    paddd         m3, m0
+    paddd         m4, m2
+    add           r6, mmsize
+    jl .loopx
+.nexty:
+    add           r0, r1
+    add           r2, r3
+    dec          r5d
+    jg .loopy
+    mov           r3, r6m
+    mov           r4, r7m
+    vextracti128 xm0, m3, 1
+    vextracti128 xm1, m4, 1
+    paddd        xm3, xm0
+    paddd        xm4, xm1
+    punpckhqdq   xm0, xm3, xm3
+    punpckhqdq   xm1, xm4, xm4
+    paddd        xm3, xm0
+    paddd        xm4, xm1
+    vpshuflw     xm0, xm3, 0xE
+    vpshuflw     xm1, xm4, 0xE
+    paddd        xm3, xm0
+    paddd        xm4, xm1
+    pxor         xm5, xm5
+    punpckldq    xm3, xm5
+    punpckldq    xm4, xm5
+    vmovq       [r3], xm3
+    vmovq       [r4], xm4
+    vzeroupper
+    RET
+%endif ; !HIGH_BIT_DEPTH
+
 ;=============================================================================
 ; variance
 ;=============================================================================
@@ -2675,6 +2748,70 @@ SSIM sse2
 INIT_AVX
 SSIM avx
 
+%ifndef HIGH_BIT_DEPTH
+;-----------------------------------------------------------------------------
+; avx2: rows 0/1 and 2/3 are widened into one ymm register each, so the four
+; row iterations become two; the lanes are then folded and the horizontal
+; part is the same as above.  ssim_end4 only has four windows per call, so it
+; doesn't get any wider and stays on the avx version.
+;-----------------------------------------------------------------------------
+INIT_YMM
+cglobal pixel_ssim_4x4x2_core_avx2, 4,5,8
+    vmovq         xm5, [r0]
+    vmovq         xm6, [r2]
+    vmovhps       xm5, [r0+r1]
+    vmovhps       xm6, [r2+r3]
+    lea            r0, [r0+r1*2]
+    lea            r2, [r2+r3*2]
+    vmovq         xm0, [r0]
+    vmovq         xm7, [r2]
+    vmovhps       xm0, [r0+r1]
+    vmovhps       xm7, [r2+r3]
+    vpmovzxbw      m5, xm5
+    vpmovzxbw      m6, xm6
+    vpmovzxbw      m0, xm0
+    vpmovzxbw      m7, xm7
+    paddw          m1, m5, m0  ; s1
+    paddw          m2, m6, m7  ; s2
+    pmaddwd        m4, m5, m6  ; s12
+    pmaddwd        m5, m5
+    pmaddwd        m6, m6
+    paddd          m3, m5, m6  ; ss
+    pmaddwd        m5, m0, m7
+    pmaddwd        m0, m0
+    pmaddwd        m7, m7
+    paddd          m4, m5
+    paddd          m3, m0
+    paddd          m3, m7
+    vextracti128  xm5, m1, 1
+    vextracti128  xm6, m2, 1
+    vextracti128  xm7, m3, 1
+    vextracti128  xm0, m4, 1
+    paddw         xm1, xm5
+    paddw         xm2, xm6
+    paddd         xm3, xm7
+    paddd         xm4, xm0
+    vzeroupper
+    mova          xm7, [pw_1]
+    vpshufd       xm5, xm3, 0xb1
+    pmaddwd       xm1, xm7
+    pmaddwd       xm2, xm7
+    vpshufd       xm6, xm4, 0xb1
+    packssdw      xm1, xm2
+    paddd         xm3, xm5
+    vpshufd       xm1, xm1, 0xd8
+    paddd         xm4, xm6
+    pmaddwd       xm1, xm7
+    punpckhdq     xm5, xm3, xm4
+    punpckldq     xm3, xm4
+    mov            r4, r4mp
+    vmovq     [r4+ 0], xm1
+    vmovq     [r4+ 8], xm3
+    vmovhps   [r4+16], xm1
+    vmovq     [r4+24], xm5
+    RET
+%endif ; !HIGH_BIT_DEPTH
+
 ;=============================================================================
 ; Successive Elimination ADS
 ;=============================================================================
@@ -2696,6 +2833,9 @@ SSIM avx
     sub     r0d, 4*%1
     jg .loop
     WIN64_RESTORE_XMM rsp
+%if mmsize == 32
+    vzeroupper
+%endif
     jmp ads_mvs
 %endmacro
 
@@ -2901,6 +3041,78 @@ ADS_SSE2 ssse3
 INIT_AVX
 ADS_SSE2 avx
 
+; avx2: 16 positions per iteration, like the sse2 ads1.  The masks share the
+; scratch buffer with the mvs, so they can't be written in larger steps.
+; packsswb works within 128-bit lanes, hence the vpermq.
+INIT_YMM
+cglobal pixel_ads4_avx2, 6,7,8
+    vpbroadcastw m7, [r0]
+    vpbroadcastw m6, [r0+4]
+    vpbroadcastw m5, [r0+8]
+    vpbroadcastw m4, [r0+12]
+    ADS_START
+.loop:
+    movu    m0, [r1]
+    movu    m1, [r1+16]
+    psubw   m0, m7
+    psubw   m1, m6
+    ABS1    m0, m2
+    ABS1    m1, m3
+    movu    m2, [r1+r2]
+    movu    m3, [r1+r2+16]
+    psubw   m2, m5
+    psubw   m3, m4
+    paddw   m0, m1
+    ABS1    m2, m1
+    ABS1    m3, m1
+    paddw   m0, m2
+    paddw   m0, m3
+    movu    m1, [r3]
+    paddusw m0, m1
+    vpbroadcastw m1, r6m
+    psubusw m1, m0
+    packsswb m1, m1
+    vpermq  m1, m1, 0xd8
+    mova    [r6], xm1
+    ADS_END 4
+
+cglobal pixel_ads2_avx2, 6,7,8
+    vpbroadcastw m7, [r0]
+    vpbroadcastw m6, [r0+4]
+    vpbroadcastw m5, r6m
+    ADS_START
+.loop:
+    movu    m0, [r1]
+    movu    m1, [r1+r2]
+    psubw   m0, m7
+    psubw   m1, m6
+    movu    m4, [r3]
+    ABS1    m0, m2
+    ABS1    m1, m3
+    paddw   m0, m1
+    paddusw m0, m4
+    psubusw m1, m5, m0
+    packsswb m1, m1
+    vpermq  m1, m1, 0xd8
+    mova    [r6], xm1
+    ADS_END 4
+
+cglobal pixel_ads1_avx2, 6,7,8
+    vpbroadcastw m7, [r0]
+    vpbroadcastw m6, r6m
+    ADS_START
+.loop:
+    movu    m0, [r1]
+    movu    m2, [r3]
+    psubw   m0, m7
+    ABS1    m0, m4
+    paddusw m0, m2
+    psubusw m4, m6, m0
+    packsswb m4, m4
+    vpermq  m4, m4, 0xd8
+    mova    [r6], xm4
+    ADS_END 4
+
 ; int pixel_ads_mvs( int16_t *mvs, uint8_t *masks, int width )
 ; {
 ;     int nmv=0, i, j;
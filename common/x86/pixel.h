@@ -127,12 +127,17 @@ void x264_pixel_ssd_nv12_core_sse2( pixel *pixuv1, int stride1,
 void x264_pixel_ssd_nv12_core_avx( pixel *pixuv1, int stride1,
                                     pixel *pixuv2, int stride2, int width,
                                     int height, uint64_t *ssd_u, uint64_t *ssd_v );
+void x264_pixel_ssd_nv12_core_avx2( uint8_t *pixuv1, int stride1,
+                                     uint8_t *pixuv2, int stride2, int width,
+                                     int height, uint64_t *ssd_u, uint64_t *ssd_v );
 void x264_pixel_ssim_4x4x2_core_mmxext( const uint8_t *pix1, int stride1,
                                         const uint8_t *pix2, int stride2, int sums[2][4] );
 void x264_pixel_ssim_4x4x2_core_sse2( const pixel *pix1, int stride1,
                                       const pixel *pix2, int stride2, int sums[2][4] );
 void x264_pixel_ssim_4x4x2_core_avx( const pixel *pix1, int stride1,
                                       const pixel *pix2, int stride2, int sums[2][4] );
+void x264_pixel_ssim_4x4x2_core_avx2( const uint8_t *pix1, int stride1,
+                                       const uint8_t *pix2, int stride2, int sums[2][4] );
 float x264_pixel_ssim_end4_sse2( int sum0[5][4], int sum1[5][4], int width );
 float x264_pixel_ssim_end4_avx( int sum0[5][4], int sum1[5][4], int width );
 int  x264_pixel_var2_8x8_mmxext( pixel *, int, pixel *, int, int * );
@@ -153,6 +158,9 @@ DECL_ADS( 2, ssse3 )
 DECL_ADS( 1, ssse3 )
 DECL_ADS( 4, avx )
 DECL_ADS( 2, avx )
+DECL_ADS( 4, avx2 )
+DECL_ADS( 2, avx2 )
+DECL_ADS( 1, avx2 )
 DECL_ADS( 1, avx )
 
 #undef DECL_PIXELS
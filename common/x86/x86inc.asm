@@ -551,6 +551,30 @@ SECTION .note.GNU-stack noalloc noexec nowrite progbits
     %define RESET_MM_PERMUTATION INIT_AVX
 %endmacro
 
+; 256-bit integer ops require AVX2. Loads and stores are VEX-encoded, so functions
+; written for ymm should use movu wherever 32-byte alignment isn't guaranteed.
+; vzeroupper must be issued before returning to code that may use legacy SSE.
+%macro INIT_YMM 0
+    %assign avx_enabled 1
+    %define RESET_MM_PERMUTATION INIT_YMM
+    %define mmsize 32
+    %define num_mmregs 8
+    %ifdef ARCH_X86_64
+    %define num_mmregs 16
+    %endif
+    %define mova vmovdqa
+    %define movu vmovdqu
+    %define movnta vmovntdq
+    %define PALIGNR PALIGNR_SSSE3
+    %assign %%i 0
+    %rep num_mmregs
+    CAT_XDEFINE m, %%i, ymm %+ %%i
+    CAT_XDEFINE nymm, %%i, %%i
+    CAT_XDEFINE xm, %%i, xmm %+ %%i
+    %assign %%i %%i+1
+    %endrep
+%endmacro
+
 INIT_MMX
 
 ; I often want to use macros that permute their arguments. e.g. there's no
@@ -687,6 +711,22 @@ INIT_MMX
 %define sizeofxmm13 16
 %define sizeofxmm14 16
 %define sizeofxmm15 16
+%define sizeofymm0 32
+%define sizeofymm1 32
+%define sizeofymm2 32
+%define sizeofymm3 32
+%define sizeofymm4 32
+%define sizeofymm5 32
+%define sizeofymm6 32
+%define sizeofymm7 32
+%define sizeofymm8 32
+%define sizeofymm9 32
+%define sizeofymm10 32
+%define sizeofymm11 32
+%define sizeofymm12 32
+%define sizeofymm13 32
+%define sizeofymm14 32
+%define sizeofymm15 32
 
 ;%1 == instruction
 ;%2 == 1 if float, 0 if int
@@ -702,17 +742,33 @@ INIT_MMX
         %define %%regmov movdqa
     %endif
 
+    ; ymm registers have no legacy SSE encoding, and in ymm functions xmm ops
+    ; are VEX-encoded too so as to avoid SSE/AVX transition penalties.
+    %if sizeof%5==32 || (sizeof%5==16 && mmsize==32)
+        %assign %%vex 1
+    %else
+        %assign %%vex 0
+    %endif
+
     %if %4>=3+%3
         %ifnidn %5, %6
-            %if avx_enabled && sizeof%5==16
+            %if avx_enabled && sizeof%5>=16
                 v%1 %5, %6, %7
             %else
                 %%regmov %5, %6
                 %1 %5, %7
             %endif
+        %elif %%vex
+            v%1 %5, %5, %7
         %else
             %1 %5, %7
         %endif
+    %elif %%vex
+        %if %3
+            v%1 %5, %5, %6, %7
+        %else
+            v%1 %5, %5, %6
+        %endif
     %elif %3
         %1 %5, %6, %7
     %else
@@ -0,0 +1,28 @@
+#define HAVE_MALLOC_H 1
+#define ARCH_X86_64 1
+#define SYS_LINUX 1
+#define HAVE_POSIXTHREAD 1
+#define HAVE_THREAD 1
+#define HAVE_LOG2F 1
+#define HAVE_VECTOREXT 1
+#define fseek fseeko
+#define ftell ftello
+#define HAVE_GPL 1
+#define HAVE_ALTIVEC 0
+#define HAVE_ALTIVEC_H 0
+#define HAVE_MMX 0
+#define HAVE_ARMV6 0
+#define HAVE_ARMV6T2 0
+#define HAVE_NEON 0
+#define HAVE_BEOSTHREAD 0
+#define HAVE_WIN32THREAD 0
+#define HAVE_VISUALIZE 0
+#define HAVE_TIMING 0
+#define HAVE_SWSCALE 0
+#define HAVE_LAVF 0
+#define HAVE_FFMS 0
+#define HAVE_GPAC 0
+#define HAVE_GF_MALLOC 0
+#define HAVE_AVS 0
+#define X264_VERSION " r0+12 981ace3"
+#define X264_POINTVER "0.116.0+12 981ace3"
@@ -0,0 +1,27 @@
+prefix=/usr/local
+exec_prefix=${prefix}
+bindir=${exec_prefix}/bin
+libdir=${exec_prefix}/lib
+includedir=${prefix}/include
+ARCH=X86_64
+SYS=LINUX
+CC=gcc
+CFLAGS=-Wshadow -O3 -ffast-math  -Wall -I. -g -fno-aggressive-loop-optimizations -std=gnu99 -s -fomit-frame-pointer -fno-tree-vectorize
+DEPMM=-MM -g0
+DEPMT=-MT
+LD=gcc -o 
+LDFLAGS= -lm -lpthread
+LDFLAGSCLI=
+LIBX264=libx264.a
+AR=ar rc 
+RANLIB=ranlib
+STRIP=strip
+AS=
+ASFLAGS= -f elf -m amd64 -DBIT_DEPTH=8
+EXE=
+HAVE_GETOPT_LONG=1
+DEVNULL=/dev/null
+PROF_GEN_CC=-fprofile-generate
+PROF_GEN_LD=-fprofile-generate
+PROF_USE_CC=-fprofile-use
+PROF_USE_LD=-fprofile-use
@@ -470,16 +470,20 @@ static void x264_mb_analyse_init( x264_t *h, x264_mb_analysis_t *a, int qp )
             if( h->i_thread_frames > 1 )
             {
                 int pix_y = (h->mb.i_mb_y | h->mb.b_interlaced) * 16;
-                int thresh = pix_y + h->param.analyse.i_mv_range_thread;
+                int thresh = pix_y + h->i_mv_range_thread;
                 for( int i = (h->sh.i_type == SLICE_TYPE_B); i >= 0; i-- )
                     for( int j = 0; j < h->i_ref[i]; j++ )
                     {
-                        x264_frame_cond_wait( h->fref[i][j]->orig, thresh );
+                        TIMER_START( wait_timer );
+                        int stall = x264_frame_cond_wait( h->fref[i][j]->orig, thresh );
+                        TIMER_STOP( h, X264_TIMING_WAIT_REF, wait_timer );
+                        h->stat.frame.i_stall_time += stall;
+                        h->stat.frame.i_stall_ref[i][j] += stall;
                         thread_mvy_range = X264_MIN( thread_mvy_range, h->fref[i][j]->orig->i_lines_completed - pix_y );
                     }
 
                 if( h->param.b_deterministic )
-                    thread_mvy_range = h->param.analyse.i_mv_range_thread;
+                    thread_mvy_range = h->i_mv_range_thread;
                 if( h->mb.b_interlaced )
                     thread_mvy_range >>= 1;
 
@@ -35,6 +35,8 @@ void x264_macroblock_analyse( x264_t *h );
 void x264_slicetype_decide( x264_t *h );
 
 void x264_slicetype_analyse( x264_t *h, int keyframe );
+int  x264_slicetype_threads_init( x264_t *h );
+void x264_slicetype_threads_delete( x264_t *h );
 
 int x264_weighted_reference_duplicate( x264_t *h, int i_ref, const x264_weight_t *w );
 
@@ -0,0 +1,195 @@
+/*****************************************************************************
+ * api.c: bit depth dispatch for --bit-depth=all builds
+ *****************************************************************************
+ * Copyright (C) 2003-2011 x264 project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ * This program is also available under a commercial proprietary license.
+ * For more information, contact us at licensing@x264.com.
+ *****************************************************************************/
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "x264.h"
+
+/* A --bit-depth=all libx264 contains the whole library twice, built at 8 and
+ * at 10 bits, with the global symbols of each copy prefixed by x264_8_ and
+ * x264_10_ (see the Makefile).  The param and picture functions don't depend
+ * on the bit depth and keep their names in the 8-bit copy; everything in x264.h
+ * that does is defined here instead, and forwards to the copy chosen by
+ * param->i_bitdepth when the encoder is opened. */
+
+#define DECLARE_DEPTH( depth )\
+x264_t *x264_##depth##_encoder_open_api( x264_param_t *, void * );\
+int     x264_##depth##_encoder_reconfig( x264_t *, x264_param_t * );\
+void    x264_##depth##_encoder_parameters( x264_t *, x264_param_t * );\
+int     x264_##depth##_encoder_headers( x264_t *, x264_nal_t **, int * );\
+int     x264_##depth##_encoder_encode( x264_t *, x264_nal_t **, int *, x264_picture_t *, x264_picture_t * );\
+void    x264_##depth##_encoder_close( x264_t * );\
+int     x264_##depth##_encoder_delayed_frames( x264_t * );\
+int     x264_##depth##_encoder_maximum_delayed_frames( x264_t * );\
+void    x264_##depth##_encoder_intra_refresh( x264_t * );\
+int     x264_##depth##_encoder_invalidate_reference( x264_t *, int64_t );\
+int     x264_##depth##_encoder_timing( x264_t *, x264_timing_t * );\
+void    x264_##depth##_nal_encode( x264_t *, uint8_t *, x264_nal_t * );\
+int64_t x264_##depth##_memory_usage( int64_t * );
+
+DECLARE_DEPTH( 8 )
+DECLARE_DEPTH( 10 )
+
+typedef struct
+{
+    x264_t *x264;
+
+    int  (*encoder_reconfig)( x264_t *, x264_param_t * );
+    void (*encoder_parameters)( x264_t *, x264_param_t * );
+    int  (*encoder_headers)( x264_t *, x264_nal_t **, int * );
+    int  (*encoder_encode)( x264_t *, x264_nal_t **, int *, x264_picture_t *, x264_picture_t * );
+    void (*encoder_close)( x264_t * );
+    int  (*encoder_delayed_frames)( x264_t * );
+    int  (*encoder_maximum_delayed_frames)( x264_t * );
+    void (*encoder_intra_refresh)( x264_t * );
+    int  (*encoder_invalidate_reference)( x264_t *, int64_t );
+    int  (*encoder_timing)( x264_t *, x264_timing_t * );
+    void (*nal_encode)( x264_t *, uint8_t *, x264_nal_t * );
+} x264_api_t;
+
+#define INIT_DEPTH( api, depth )\
+{\
+    api->encoder_reconfig               = x264_##depth##_encoder_reconfig;\
+    api->encoder_parameters             = x264_##depth##_encoder_parameters;\
+    api->encoder_headers                = x264_##depth##_encoder_headers;\
+    api->encoder_encode                 = x264_##depth##_encoder_encode;\
+    api->encoder_close                  = x264_##depth##_encoder_close;\
+    api->encoder_delayed_frames         = x264_##depth##_encoder_delayed_frames;\
+    api->encoder_maximum_delayed_frames = x264_##depth##_encoder_maximum_delayed_frames;\
+    api->encoder_intra_refresh          = x264_##depth##_encoder_intra_refresh;\
+    api->encoder_invalidate_reference   = x264_##depth##_encoder_invalidate_reference;\
+    api->encoder_timing                 = x264_##depth##_encoder_timing;\
+    api->nal_encode                     = x264_##depth##_nal_encode;\
+    api->x264 = x264_##depth##_encoder_open_api( param, api );\
+}
+
+const int x264_bit_depth = 0;
+
+static void api_log( x264_param_t *param, int i_level, const char *psz_fmt, ... )
+{
+    if( !param->pf_log || i_level > param->i_log_level )
+        return;
+    va_list arg;
+    va_start( arg, psz_fmt );
+    param->pf_log( param->p_log_private, i_level, psz_fmt, arg );
+    va_end( arg );
+}
+
+x264_t *x264_encoder_open( x264_param_t *param )
+{
+    x264_api_t *api = calloc( 1, sizeof(x264_api_t) );
+    if( !api )
+        return NULL;
+
+    if( param->i_bitdepth == 8 )
+        INIT_DEPTH( api, 8 )
+    else if( param->i_bitdepth == 10 )
+        INIT_DEPTH( api, 10 )
+    else
+        api_log( param, X264_LOG_ERROR, "unsupported bit depth %d, use 8 or 10\n", param->i_bitdepth );
+
+    if( !api->x264 )
+    {
+        free( api );
+        return NULL;
+    }
+    return (x264_t*)api;
+}
+
+void x264_encoder_close( x264_t *h )
+{
+    x264_api_t *api = (x264_api_t*)h;
+    api->encoder_close( api->x264 );
+    free( api );
+}
+
+int x264_encoder_reconfig( x264_t *h, x264_param_t *param )
+{
+    x264_api_t *api = (x264_api_t*)h;
+    return api->encoder_reconfig( api->x264, param );
+}
+
+void x264_encoder_parameters( x264_t *h, x264_param_t *param )
+{
+    x264_api_t *api = (x264_api_t*)h;
+    api->encoder_parameters( api->x264, param );
+}
+
+int x264_encoder_headers( x264_t *h, x264_nal_t **pp_nal, int *pi_nal )
+{
+    x264_api_t *api = (x264_api_t*)h;
+    return api->encoder_headers( api->x264, pp_nal, pi_nal );
+}
+
+int x264_encoder_encode( x264_t *h, x264_nal_t **pp_nal, int *pi_nal, x264_picture_t *pic_in, x264_picture_t *pic_out )
+{
+    x264_api_t *api = (x264_api_t*)h;
+    return api->encoder_encode( api->x264, pp_nal, pi_nal, pic_in, pic_out );
+}
+
+int x264_encoder_delayed_frames( x264_t *h )
+{
+    x264_api_t *api = (x264_api_t*)h;
+    return api->encoder_delayed_frames( api->x264 );
+}
+
+int x264_encoder_maximum_delayed_frames( x264_t *h )
+{
+    x264_api_t *api = (x264_api_t*)h;
+    return api->encoder_maximum_delayed_frames( api->x264 );
+}
+
+void x264_encoder_intra_refresh( x264_t *h )
+{
+    x264_api_t *api = (x264_api_t*)h;
+    api->encoder_intra_refresh( api->x264 );
+}
+
+int x264_encoder_invalidate_reference( x264_t *h, int64_t pts )
+{
+    x264_api_t *api = (x264_api_t*)h;
+    return api->encoder_invalidate_reference( api->x264, pts );
+}
+
+int x264_encoder_timing( x264_t *h, x264_timing_t *timing )
+{
+    x264_api_t *api = (x264_api_t*)h;
+    return api->encoder_timing( api->x264, timing );
+}
+
+/* nalu_process is called with the x264_api_t, so this is what comes back here */
+void x264_nal_encode( x264_t *h, uint8_t *dst, x264_nal_t *nal )
+{
+    x264_api_t *api = (x264_api_t*)h;
+    api->nal_encode( api->x264, dst, nal );
+}
+
+int64_t x264_memory_usage( int64_t *peak )
+{
+    int64_t peak8, peak10;
+    int64_t current = x264_8_memory_usage( &peak8 ) + x264_10_memory_usage( &peak10 );
+    if( peak )
+        *peak = peak8 + peak10;
+    return current;
+}
@@ -559,56 +559,79 @@ static const uint8_t count_cat_m1[5] = {15, 14, 15, 3, 14};
 #if !RDO_SKIP_BS
 static void block_residual_write_cabac( x264_t *h, x264_cabac_t *cb, int ctx_block_cat, dctcoef *l )
 {
-    const uint8_t *sig_offset = significant_coeff_flag_offset_8x8[h->mb.b_interlaced];
     int ctx_sig = significant_coeff_flag_offset[h->mb.b_interlaced][ctx_block_cat];
     int ctx_last = last_coeff_flag_offset[h->mb.b_interlaced][ctx_block_cat];
     int ctx_level = coeff_abs_level_m1_offset[ctx_block_cat];
-    int coeff_idx = -1, node_ctx = 0, last;
-    int coeffs[64];
-
-    last = h->quantf.coeff_last[ctx_block_cat]( l );
-
-#define WRITE_SIGMAP( l8x8 )\
-    int i = 0;\
-    while( 1 )\
-    {\
-        if( l[i] )\
-        {\
-            coeffs[++coeff_idx] = l[i];\
-            x264_cabac_encode_decision( cb, ctx_sig + (l8x8 ? sig_offset[i] : i), 1 );\
-            if( i == last )\
-            {\
-                x264_cabac_encode_decision( cb, ctx_last + (l8x8 ? last_coeff_flag_offset_8x8[i] : i), 1 );\
-                break;\
-            }\
-            else\
-                x264_cabac_encode_decision( cb, ctx_last + (l8x8 ? last_coeff_flag_offset_8x8[i] : i), 0 );\
-        }\
-        else\
-            x264_cabac_encode_decision( cb, ctx_sig + (l8x8 ? sig_offset[i] : i), 0 );\
-        i++;\
-        if( i == count_m1 )\
-        {\
-            coeffs[++coeff_idx] = l[i];\
-            break;\
-        }\
-    }
+    int node_ctx = 0, total;
+    dctcoef *levels;
+    dctcoef coeffs[64];
+    x264_run_level_t runlevel;
 
     if( ctx_block_cat == DCT_LUMA_8x8 )
     {
-        int count_m1 = 63;
-        WRITE_SIGMAP( 1 )
+        /* Store the coefficients backwards so that they end up in the same
+         * last-to-first order as coeff_level_run's output. */
+        const uint8_t *sig_offset = significant_coeff_flag_offset_8x8[h->mb.b_interlaced];
+        int last = h->quantf.coeff_last[DCT_LUMA_8x8]( l );
+        int coeff_idx = 64;
+        int i = 0;
+        while( 1 )
+        {
+            if( l[i] )
+            {
+                coeffs[--coeff_idx] = l[i];
+                x264_cabac_encode_decision( cb, ctx_sig + sig_offset[i], 1 );
+                if( i == last )
+                {
+                    x264_cabac_encode_decision( cb, ctx_last + last_coeff_flag_offset_8x8[i], 1 );
+                    break;
+                }
+                else
+                    x264_cabac_encode_decision( cb, ctx_last + last_coeff_flag_offset_8x8[i], 0 );
+            }
+            else
+                x264_cabac_encode_decision( cb, ctx_sig + sig_offset[i], 0 );
+            if( ++i == 63 )
+            {
+                coeffs[--coeff_idx] = l[i];
+                break;
+            }
+        }
+        levels = coeffs + coeff_idx;
+        total = 64 - coeff_idx;
     }
     else
     {
+        /* The significance map is fully described by the run lengths between
+         * nonzero coefficients, so walk those instead of testing every coefficient. */
         int count_m1 = count_cat_m1[ctx_block_cat];
-        WRITE_SIGMAP( 0 )
+        int i = 0;
+        total = h->quantf.coeff_level_run[ctx_block_cat]( l, &runlevel );
+        levels = runlevel.level;
+        /* The asm coeff_level_run doesn't write the run below the first
+         * coefficient, so get its position from the last one and the other runs. */
+        int first = runlevel.last + 1 - total;
+        for( int k = 0; k < total-1; k++ )
+            first -= runlevel.run[k];
+        for( ; i < first; i++ )
+            x264_cabac_encode_decision( cb, ctx_sig + i, 0 );
+        for( int k = total-1; k >= 0; k-- )
+        {
+            if( i == count_m1 )
+                break;
+            x264_cabac_encode_decision( cb, ctx_sig + i, 1 );
+            x264_cabac_encode_decision( cb, ctx_last + i, !k );
+            i++;
+            if( k )
+                for( int run = runlevel.run[k-1]; run > 0; run--, i++ )
+                    x264_cabac_encode_decision( cb, ctx_sig + i, 0 );
+        }
     }
 
-    do
+    for( int k = 0; k < total; k++ )
     {
         /* write coeff_abs - 1 */
-        int coeff = coeffs[coeff_idx];
+        int coeff = levels[k];
         int abs_coeff = abs(coeff);
         int coeff_sign = coeff >> 31;
         int ctx = coeff_abs_level1_ctx[node_ctx] + ctx_level;
@@ -633,102 +656,100 @@ static void block_residual_write_cabac( x264_t *h, x264_cabac_t *cb, int ctx_blo
         }
 
         x264_cabac_encode_bypass( cb, coeff_sign );
-    } while( --coeff_idx >= 0 );
+    }
 }
 #define block_residual_write_cabac_8x8( h, cb, l ) block_residual_write_cabac( h, cb, DCT_LUMA_8x8, l )
 
 #else
 
-/* Faster RDO by merging sigmap and level coding.  Note that for 8x8dct
- * this is slightly incorrect because the sigmap is not reversible
- * (contexts are repeated).  However, there is nearly no quality penalty
- * for this (~0.001db) and the speed boost (~30%) is worth it. */
-static void ALWAYS_INLINE block_residual_write_cabac_internal( x264_t *h, x264_cabac_t *cb, int ctx_block_cat, dctcoef *l, int b_8x8 )
+/* Cost of coeff_abs_level_minus1 and the sign, using the precomputed unary
+ * tables for the prefix.  Returns the updated node ctx. */
+static ALWAYS_INLINE int block_residual_write_cabac_level( x264_cabac_t *cb, int ctx_level, int node_ctx, int coeff_abs )
 {
-    const uint8_t *sig_offset = significant_coeff_flag_offset_8x8[h->mb.b_interlaced];
-    int ctx_sig = significant_coeff_flag_offset[h->mb.b_interlaced][ctx_block_cat];
-    int ctx_last = last_coeff_flag_offset[h->mb.b_interlaced][ctx_block_cat];
-    int ctx_level = coeff_abs_level_m1_offset[ctx_block_cat];
-    int last = h->quantf.coeff_last[ctx_block_cat]( l );
-    int coeff_abs = abs(l[last]);
-    int ctx = coeff_abs_level1_ctx[0] + ctx_level;
-    int node_ctx;
-
-    if( last != (b_8x8 ? 63 : count_cat_m1[ctx_block_cat]) )
-    {
-        x264_cabac_encode_decision( cb, ctx_sig + (b_8x8 ? sig_offset[last] : last), 1 );
-        x264_cabac_encode_decision( cb, ctx_last + (b_8x8 ? last_coeff_flag_offset_8x8[last] : last), 1 );
-    }
-
+    int ctx = coeff_abs_level1_ctx[node_ctx] + ctx_level;
     if( coeff_abs > 1 )
     {
+        int prefix = X264_MIN( coeff_abs-1, 14 );
         x264_cabac_encode_decision( cb, ctx, 1 );
-        ctx = coeff_abs_levelgt1_ctx[0] + ctx_level;
-        if( coeff_abs < 15 )
-        {
-            cb->f8_bits_encoded += cabac_size_unary[coeff_abs-1][cb->state[ctx]];
-            cb->state[ctx] = cabac_transition_unary[coeff_abs-1][cb->state[ctx]];
-        }
-        else
-        {
-            cb->f8_bits_encoded += cabac_size_unary[14][cb->state[ctx]];
-            cb->state[ctx] = cabac_transition_unary[14][cb->state[ctx]];
+        ctx = coeff_abs_levelgt1_ctx[node_ctx] + ctx_level;
+        cb->f8_bits_encoded += cabac_size_unary[prefix][cb->state[ctx]];
+        cb->state[ctx] = cabac_transition_unary[prefix][cb->state[ctx]];
+        if( coeff_abs >= 15 )
             x264_cabac_encode_ue_bypass( cb, 0, coeff_abs - 15 );
-        }
-        node_ctx = coeff_abs_level_transition[1][0];
+        return coeff_abs_level_transition[1][node_ctx];
     }
     else
     {
         x264_cabac_encode_decision( cb, ctx, 0 );
-        node_ctx = coeff_abs_level_transition[0][0];
         x264_cabac_encode_bypass( cb, 0 ); // sign
+        return coeff_abs_level_transition[0][node_ctx];
     }
+}
+
+/* Faster RDO by merging sigmap and level coding.  Note that for 8x8dct
+ * this is slightly incorrect because the sigmap is not reversible
+ * (contexts are repeated).  However, there is nearly no quality penalty
+ * for this (~0.001db) and the speed boost (~30%) is worth it. */
+static void block_residual_write_cabac_8x8( x264_t *h, x264_cabac_t *cb, dctcoef *l )
+{
+    const uint8_t *sig_offset = significant_coeff_flag_offset_8x8[h->mb.b_interlaced];
+    int ctx_sig = significant_coeff_flag_offset[h->mb.b_interlaced][DCT_LUMA_8x8];
+    int ctx_last = last_coeff_flag_offset[h->mb.b_interlaced][DCT_LUMA_8x8];
+    int ctx_level = coeff_abs_level_m1_offset[DCT_LUMA_8x8];
+    int last = h->quantf.coeff_last[DCT_LUMA_8x8]( l );
+    int node_ctx;
+
+    if( last != 63 )
+    {
+        x264_cabac_encode_decision( cb, ctx_sig + sig_offset[last], 1 );
+        x264_cabac_encode_decision( cb, ctx_last + last_coeff_flag_offset_8x8[last], 1 );
+    }
+    node_ctx = block_residual_write_cabac_level( cb, ctx_level, 0, abs(l[last]) );
 
     for( int i = last-1 ; i >= 0; i-- )
     {
         if( l[i] )
         {
-            coeff_abs = abs(l[i]);
-            x264_cabac_encode_decision( cb, ctx_sig + (b_8x8 ? sig_offset[i] : i), 1 );
-            x264_cabac_encode_decision( cb, ctx_last + (b_8x8 ? last_coeff_flag_offset_8x8[i] : i), 0 );
-            ctx = coeff_abs_level1_ctx[node_ctx] + ctx_level;
-
-            if( coeff_abs > 1 )
-            {
-                x264_cabac_encode_decision( cb, ctx, 1 );
-                ctx = coeff_abs_levelgt1_ctx[node_ctx] + ctx_level;
-                if( coeff_abs < 15 )
-                {
-                    cb->f8_bits_encoded += cabac_size_unary[coeff_abs-1][cb->state[ctx]];
-                    cb->state[ctx] = cabac_transition_unary[coeff_abs-1][cb->state[ctx]];
-                }
-                else
-                {
-                    cb->f8_bits_encoded += cabac_size_unary[14][cb->state[ctx]];
-                    cb->state[ctx] = cabac_transition_unary[14][cb->state[ctx]];
-                    x264_cabac_encode_ue_bypass( cb, 0, coeff_abs - 15 );
-                }
-                node_ctx = coeff_abs_level_transition[1][node_ctx];
-            }
-            else
-            {
-                x264_cabac_encode_decision( cb, ctx, 0 );
-                node_ctx = coeff_abs_level_transition[0][node_ctx];
-                x264_cabac_encode_bypass( cb, 0 );
-            }
+            x264_cabac_encode_decision( cb, ctx_sig + sig_offset[i], 1 );
+            x264_cabac_encode_decision( cb, ctx_last + last_coeff_flag_offset_8x8[i], 0 );
+            node_ctx = block_residual_write_cabac_level( cb, ctx_level, node_ctx, abs(l[i]) );
         }
         else
-            x264_cabac_encode_decision( cb, ctx_sig + (b_8x8 ? sig_offset[i] : i), 0 );
+            x264_cabac_encode_decision( cb, ctx_sig + sig_offset[i], 0 );
     }
 }
 
-static void block_residual_write_cabac_8x8( x264_t *h, x264_cabac_t *cb, dctcoef *l )
-{
-    block_residual_write_cabac_internal( h, cb, DCT_LUMA_8x8, l, 1 );
-}
+/* Same as above, but the zero runs come from coeff_level_run, which avoids
+ * a data-dependent branch per coefficient. */
 static void block_residual_write_cabac( x264_t *h, x264_cabac_t *cb, int ctx_block_cat, dctcoef *l )
 {
-    block_residual_write_cabac_internal( h, cb, ctx_block_cat, l, 0 );
+    int ctx_sig = significant_coeff_flag_offset[h->mb.b_interlaced][ctx_block_cat];
+    int ctx_last = last_coeff_flag_offset[h->mb.b_interlaced][ctx_block_cat];
+    int ctx_level = coeff_abs_level_m1_offset[ctx_block_cat];
+    x264_run_level_t runlevel;
+    int total = h->quantf.coeff_level_run[ctx_block_cat]( l, &runlevel );
+    int i = runlevel.last;
+    int node_ctx;
+
+    if( i != count_cat_m1[ctx_block_cat] )
+    {
+        x264_cabac_encode_decision( cb, ctx_sig + i, 1 );
+        x264_cabac_encode_decision( cb, ctx_last + i, 1 );
+    }
+    node_ctx = block_residual_write_cabac_level( cb, ctx_level, 0, abs(runlevel.level[0]) );
+
+    for( int k = 1; k < total; k++ )
+    {
+        for( int run = runlevel.run[k-1]; run > 0; run-- )
+            x264_cabac_encode_decision( cb, ctx_sig + --i, 0 );
+        i--;
+        x264_cabac_encode_decision( cb, ctx_sig + i, 1 );
+        x264_cabac_encode_decision( cb, ctx_last + i, 0 );
+        node_ctx = block_residual_write_cabac_level( cb, ctx_level, node_ctx, abs(runlevel.level[k]) );
+    }
+    /* the zeros below the first coefficient: the asm coeff_level_run doesn't write run[total-1] */
+    while( i > 0 )
+        x264_cabac_encode_decision( cb, ctx_sig + --i, 0 );
 }
 #endif
 
@@ -32,6 +32,7 @@
 #include "ratecontrol.h"
 #include "macroblock.h"
 #include "me.h"
+#include "framelog.h"
 
 #if HAVE_VISUALIZE
 #include "common/visualize.h"
@@ -381,6 +382,15 @@ static void x264_encoder_thread_init( x264_t *h )
  *
  ****************************************************************************/
 
+// round up to use the whole mb row
+static int x264_mv_range_thread_round( int r )
+{
+    int r2 = (r & ~15) + ((-X264_THREAD_HEIGHT) & 15);
+    if( r2 < r )
+        r2 += 16;
+    return r2;
+}
+
 static int x264_validate_parameters( x264_t *h, int b_open )
 {
 #if HAVE_MMX
@@ -410,6 +420,11 @@ static int x264_validate_parameters( x264_t *h, int b_open )
                   h->param.i_width, h->param.i_height );
         return -1;
     }
+    if( h->param.i_bitdepth != BIT_DEPTH )
+    {
+        x264_log( h, X264_LOG_ERROR, "this build supports only bit depth %d\n", BIT_DEPTH );
+        return -1;
+    }
     int i_csp = h->param.i_csp & X264_CSP_MASK;
     if( i_csp <= X264_CSP_NONE || i_csp >= X264_CSP_MAX )
     {
@@ -448,6 +463,14 @@ static int x264_validate_parameters( x264_t *h, int b_open )
     if( h->i_thread_frames > 1 )
         h->param.nalu_process = NULL;
 
+#if HAVE_THREAD
+    if( h->param.i_lookahead_threads == X264_THREADS_AUTO )
+        h->param.i_lookahead_threads = h->param.i_threads / 4;
+    h->param.i_lookahead_threads = x264_clip3( h->param.i_lookahead_threads, 1, X264_LOOKAHEAD_THREAD_MAX );
+#else
+    h->param.i_lookahead_threads = 1;
+#endif
+
     h->param.i_keyint_max = x264_clip3( h->param.i_keyint_max, 1, X264_KEYINT_MAX_INFINITE );
     if( h->param.i_keyint_max == 1 )
     {
@@ -465,7 +488,7 @@ static int x264_validate_parameters( x264_t *h, int b_open )
         score += h->param.rc.i_qp_step == 3;
         score += h->param.i_keyint_max == 12;
         score += h->param.rc.i_qp_min == 2;
-        score += h->param.rc.i_qp_max == 31;
+        score += x264_clip3( h->param.rc.i_qp_max, 0, QP_MAX ) == 31;
         score += h->param.rc.f_qcompress == 0.5;
         score += fabs(h->param.rc.f_ip_factor - 1.25) < 0.01;
         score += fabs(h->param.rc.f_pb_factor - 1.25) < 0.01;
@@ -488,6 +511,8 @@ static int x264_validate_parameters( x264_t *h, int b_open )
     }
     h->param.rc.f_rf_constant = x264_clip3f( h->param.rc.f_rf_constant, -QP_BD_OFFSET, 51 );
     h->param.rc.f_rf_constant_max = x264_clip3f( h->param.rc.f_rf_constant_max, -QP_BD_OFFSET, 51 );
+    if( h->param.rc.i_qp_constant == -1 )
+        h->param.rc.i_qp_constant = 23 + QP_BD_OFFSET;
     h->param.rc.i_qp_constant = x264_clip3( h->param.rc.i_qp_constant, 0, QP_MAX );
     h->param.analyse.i_subpel_refine = x264_clip3( h->param.analyse.i_subpel_refine, 0, 10 );
     h->param.rc.f_ip_factor = X264_MAX( h->param.rc.f_ip_factor, 0.01f );
@@ -658,6 +683,7 @@ static int x264_validate_parameters( x264_t *h, int b_open )
         h->param.i_keyint_min = X264_MIN( h->param.i_keyint_max / 10, fps );
     h->param.i_keyint_min = x264_clip3( h->param.i_keyint_min, 1, h->param.i_keyint_max/2+1 );
     h->param.rc.i_lookahead = x264_clip3( h->param.rc.i_lookahead, 0, X264_LOOKAHEAD_MAX );
+    h->param.rc.i_lookahead_pyramid = x264_clip3( h->param.rc.i_lookahead_pyramid, 0, 2 );
     {
         int maxrate = X264_MAX( h->param.rc.i_vbv_max_bitrate, h->param.rc.i_bitrate );
         float bufsize = maxrate ? (float)h->param.rc.i_vbv_buffer_size / maxrate : 0;
@@ -683,7 +709,7 @@ static int x264_validate_parameters( x264_t *h, int b_open )
         h->param.rc.i_lookahead = 0;
 #if HAVE_THREAD
     if( h->param.i_sync_lookahead < 0 )
-        h->param.i_sync_lookahead = h->param.i_bframe + 1;
+        h->param.i_sync_lookahead = h->param.b_low_memory ? 0 : h->param.i_bframe + 1;
     h->param.i_sync_lookahead = X264_MIN( h->param.i_sync_lookahead, X264_LOOKAHEAD_MAX );
     if( h->param.rc.b_stat_read || h->i_thread_frames == 1 )
         h->param.i_sync_lookahead = 0;
@@ -845,13 +871,11 @@ static int x264_validate_parameters( x264_t *h, int b_open )
             // in thread synchronization.
             int max_range = (h->param.i_height + X264_THREAD_HEIGHT) / h->i_thread_frames - X264_THREAD_HEIGHT;
             r = max_range / 2;
+            h->b_mv_range_thread_adapt = 1;
         }
         r = X264_MAX( r, h->param.analyse.i_me_range );
         r = X264_MIN( r, h->param.analyse.i_mv_range );
-        // round up to use the whole mb row
-        r2 = (r & ~15) + ((-X264_THREAD_HEIGHT) & 15);
-        if( r2 < r )
-            r2 += 16;
+        r2 = x264_mv_range_thread_round( r );
         x264_log( h, X264_LOG_DEBUG, "using mv_range_thread = %d\n", r2 );
         h->param.analyse.i_mv_range_thread = r2;
     }
@@ -973,9 +997,10 @@ static void x264_set_aspect_ratio( x264_t *h, x264_param_t *param, int initial )
 }
 
 /****************************************************************************
- * x264_encoder_open:
+ * x264_encoder_open_api: x264_encoder_open, with the handle that nalu_process
+ * is called with in place of the encoder (used by encoder/api.c)
  ****************************************************************************/
-x264_t *x264_encoder_open( x264_param_t *param )
+x264_t *x264_encoder_open_api( x264_param_t *param, void *api )
 {
     x264_t *h;
     char buf[1000], *p;
@@ -983,8 +1008,14 @@ x264_t *x264_encoder_open( x264_param_t *param )
 
     CHECKED_MALLOCZERO( h, sizeof(x264_t) );
 
+#if HAVE_TIMING
+    h->i_timer_start = x264_timer_read();
+    h->i_mdate_start = x264_mdate();
+#endif
+
     /* Create a copy of param */
     memcpy( &h->param, param, sizeof(x264_param_t) );
+    h->api = api;
 
     if( param->param_free )
         param->param_free( param );
@@ -1064,7 +1095,7 @@ x264_t *x264_encoder_open( x264_param_t *param )
           || h->param.rc.b_mb_tree
           || h->param.analyse.i_weighted_pred );
     h->frames.b_have_lowres |= h->param.rc.b_stat_read && h->param.rc.i_vbv_buffer_size > 0;
-    h->frames.b_have_sub8x8_esa = !!(h->param.analyse.inter & X264_ANALYSE_PSUB8x8);
+    h->frames.b_have_sub8x8_esa = !!(h->param.analyse.inter & X264_ANALYSE_PSUB8x8) || h->param.analyse.i_me_method == X264_ME_ESA;
 
     h->frames.i_last_idr =
     h->frames.i_last_keyframe = - h->param.i_keyint_max;
@@ -1156,9 +1187,15 @@ x264_t *x264_encoder_open( x264_param_t *param )
     }
 
     h->out.i_nal = 0;
-    h->out.i_bitstream = X264_MAX( 1000000, h->param.i_width * h->param.i_height * 4
+    h->out.i_bitstream = h->param.i_width * h->param.i_height * 4
         * ( h->param.rc.i_rc_method == X264_RC_ABR ? pow( 0.95, h->param.rc.i_qp_min )
-          : pow( 0.95, h->param.rc.i_qp_constant ) * X264_MAX( 1, h->param.rc.f_ip_factor )));
+          : pow( 0.95, h->param.rc.i_qp_constant ) * X264_MAX( 1, h->param.rc.f_ip_factor ));
+    /* The bitstream and nal buffers grow when a frame doesn't fit, so the
+     * low-memory mode starts them at a typical rather than a worst-case size. */
+    if( h->param.b_low_memory )
+        h->out.i_bitstream = X264_MAX( 100000, h->out.i_bitstream / 4 );
+    else
+        h->out.i_bitstream = X264_MAX( 1000000, h->out.i_bitstream );
 
     CHECKED_MALLOC( h->nal_buffer, h->out.i_bitstream * 3/2 + 4 );
     h->nal_buffer_size = h->out.i_bitstream * 3/2 + 4;
@@ -1166,6 +1203,11 @@ x264_t *x264_encoder_open( x264_param_t *param )
     if( h->param.i_threads > 1 &&
         x264_threadpool_init( &h->threadpool, h->param.i_threads, (void*)x264_encoder_thread_init, h ) )
         goto fail;
+    /* With frame threads, psnr/ssim are measured once the whole frame is done so
+     * that they don't hold up the rows other threads are waiting on. */
+    if( h->i_thread_frames > 1 && (h->param.analyse.b_psnr || h->param.analyse.b_ssim) &&
+        x264_threadpool_init( &h->metricspool, h->i_thread_frames, (void*)x264_encoder_thread_init, h ) )
+        goto fail;
 
     h->thread[0] = h;
     for( int i = 1; i < h->param.i_threads + !!h->param.i_sync_lookahead; i++ )
@@ -1232,6 +1274,9 @@ x264_t *x264_encoder_open( x264_param_t *param )
         fclose( f );
     }
 
+    if( h->param.psz_frame_log && x264_frame_log_init( h ) < 0 )
+        goto fail;
+
     const char *profile = h->sps->i_profile_idc == PROFILE_BASELINE ? "Constrained Baseline" :
                           h->sps->i_profile_idc == PROFILE_MAIN ? "Main" :
                           h->sps->i_profile_idc == PROFILE_HIGH ? "High" :
@@ -1259,6 +1304,14 @@ fail:
     return NULL;
 }
 
+/****************************************************************************
+ * x264_encoder_open:
+ ****************************************************************************/
+x264_t *x264_encoder_open( x264_param_t *param )
+{
+    return x264_encoder_open_api( param, NULL );
+}
+
 /****************************************************************************
  * x264_encoder_reconfig:
  ****************************************************************************/
@@ -1387,7 +1440,7 @@ static int x264_nal_end( x264_t *h )
     x264_nal_t *nal = &h->out.nal[h->out.i_nal];
     nal->i_payload = &h->out.p_bitstream[bs_pos( &h->out.bs ) / 8] - nal->p_payload;
     if( h->param.nalu_process )
-        h->param.nalu_process( h, nal );
+        h->param.nalu_process( h->api ? h->api : h, nal );
     h->out.i_nal++;
 
     return x264_nal_check_buffer( h );
@@ -1737,13 +1790,109 @@ static inline void x264_reference_build_list( x264_t *h, int i_poc )
     h->mb.pic.i_fref[1] = h->i_ref[1];
 }
 
+/* Frame threads wait until their references are i_mv_range_thread rows ahead of them.
+ * If the lookahead saw little vertical motion in this frame, a smaller lag costs no search
+ * range and lets the threads run closer together.  Only depends on the lowres mvs, so the
+ * output stays deterministic. */
+static void x264_mv_range_thread_update( x264_t *h )
+{
+    int range = h->param.analyse.i_mv_range_thread;
+    if( h->b_mv_range_thread_adapt && h->frames.b_have_lowres && h->sh.i_type != SLICE_TYPE_I )
+    {
+        /* the lookahead skips the edge mbs unless it needs a spatial distribution,
+         * so theirs are left over from an earlier use of the frame */
+        int b_edges = h->param.rc.b_mb_tree || h->param.rc.i_vbv_buffer_size ||
+                      h->mb.i_mb_width <= 2 || h->mb.i_mb_height <= 2;
+        /* largest vertical lowres motion per frame of distance, in lowres qpel */
+        int motion = -1;
+        for( int l = 0; l <= !!h->param.i_bframe; l++ )
+            for( int d = 0; d <= h->param.i_bframe; d++ )
+            {
+                int16_t (*mvs)[2] = h->fenc->lowres_mvs[l][d];
+                if( mvs[0][0] == 0x7FFF )
+                    continue;
+                int max = 0;
+                for( int y = !b_edges; y < h->mb.i_mb_height - !b_edges; y++ )
+                    for( int x = !b_edges; x < h->mb.i_mb_width - !b_edges; x++ )
+                        max = X264_MAX( max, abs( mvs[x + y*h->mb.i_mb_width][1] ) );
+                motion = X264_MAX( motion, (max + d) / (d + 1) );
+            }
+        if( motion >= 0 )
+        {
+            int dist = 0;
+            for( int l = 0; l < 2; l++ )
+                for( int j = 0; j < h->i_ref[l]; j++ )
+                    dist = X264_MAX( dist, abs( h->fenc->i_frame - h->fref[l][j]->orig->i_frame ) );
+            /* lowres qpel to fullres pels, plus room for the fullres search around it */
+            int need = (motion * dist + 1) / 2 + h->param.analyse.i_me_range;
+            range = X264_MIN( range, x264_mv_range_thread_round( need ) );
+        }
+    }
+    h->i_mv_range_thread = range;
+}
+
+/* min_y and max_y are in pixels; rows are measured in the same chunks whether
+ * this runs in the filter or on the metrics pool, so the results don't change. */
+static void x264_fdec_measure_rows( x264_t *h, int min_y, int max_y, int b_start )
+{
+    TIMER_START( metrics_timer );
+    if( h->param.analyse.b_psnr )
+    {
+        uint64_t ssd_y = x264_pixel_ssd_wxh( &h->pixf,
+            h->fdec->plane[0] + min_y * h->fdec->i_stride[0], h->fdec->i_stride[0],
+            h->fenc->plane[0] + min_y * h->fenc->i_stride[0], h->fenc->i_stride[0],
+            h->param.i_width, max_y-min_y );
+        uint64_t ssd_u, ssd_v;
+        x264_pixel_ssd_nv12( &h->pixf,
+            h->fdec->plane[1] + (min_y>>1) * h->fdec->i_stride[1], h->fdec->i_stride[1],
+            h->fenc->plane[1] + (min_y>>1) * h->fenc->i_stride[1], h->fenc->i_stride[1],
+            h->param.i_width>>1, (max_y-min_y)>>1, &ssd_u, &ssd_v );
+        h->stat.frame.i_ssd[0] += ssd_y;
+        h->stat.frame.i_ssd[1] += ssd_u;
+        h->stat.frame.i_ssd[2] += ssd_v;
+    }
+
+    if( h->param.analyse.b_ssim )
+    {
+        x264_emms();
+        /* offset by 2 pixels to avoid alignment of ssim blocks with dct blocks,
+         * and overlap by 4 */
+        min_y += b_start ? 2 : -6;
+        h->stat.frame.f_ssim +=
+            x264_pixel_ssim_wxh( &h->pixf,
+                h->fdec->plane[0] + 2+min_y*h->fdec->i_stride[0], h->fdec->i_stride[0],
+                h->fenc->plane[0] + 2+min_y*h->fenc->i_stride[0], h->fenc->i_stride[0],
+                h->param.i_width-2, max_y-min_y, h->scratch_buffer );
+    }
+    TIMER_STOP( h, X264_TIMING_METRICS, metrics_timer );
+}
+
+#if HAVE_THREAD
+/* Runs on metricspool once all rows of the frame are filtered, replaying the
+ * row chunks of x264_fdec_filter_row.  Nothing else touches h until
+ * x264_encoder_frame_end has waited for it. */
+static void *x264_fdec_measure_frame( x264_t *h )
+{
+    int step = 1 << h->sh.b_mbaff;
+    for( int mb_y = h->i_threadslice_start + step; mb_y <= h->i_threadslice_end; mb_y += step )
+    {
+        int b_start = mb_y - step == h->i_threadslice_start;
+        int b_end = mb_y == h->i_threadslice_end;
+        int min_y = (mb_y - step)*16 - 8 * !b_start;
+        int max_y = b_end ? X264_MIN( h->i_threadslice_end*16 , h->param.i_height ) : mb_y*16 - 8;
+        x264_fdec_measure_rows( h, min_y, max_y, b_start );
+    }
+    return NULL;
+}
+#endif
+
 static void x264_fdec_filter_row( x264_t *h, int mb_y, int b_inloop )
 {
     /* mb_y is the mb to be encoded next, not the mb to be filtered here */
     int b_hpel = h->fdec->b_kept_as_ref;
     int b_deblock = h->sh.i_disable_deblocking_filter_idc != 1;
     int b_end = mb_y == h->i_threadslice_end;
-    int b_measure_quality = 1;
+    int b_measure_quality = !h->metricspool;
     int min_y = mb_y - (1 << h->sh.b_mbaff);
     int b_start = min_y == h->i_threadslice_start;
     int max_y = b_end ? h->i_threadslice_end : mb_y;
@@ -1758,6 +1907,7 @@ static void x264_fdec_filter_row( x264_t *h, int mb_y, int b_inloop )
     if( min_y < h->i_threadslice_start )
         return;
 
+    TIMER_START( filter_timer );
     if( b_deblock )
         for( int y = min_y; y < max_y; y += (1 << h->sh.b_mbaff) )
             x264_frame_deblock_row( h, y );
@@ -1775,40 +1925,13 @@ static void x264_fdec_filter_row( x264_t *h, int mb_y, int b_inloop )
 
     if( h->i_thread_frames > 1 && h->fdec->b_kept_as_ref )
         x264_frame_cond_broadcast( h->fdec, mb_y*16 + (b_end ? 10000 : -(X264_THREAD_HEIGHT << h->sh.b_mbaff)) );
+    TIMER_STOP( h, X264_TIMING_FILTER, filter_timer );
 
-    min_y = min_y*16 - 8 * !b_start;
-    max_y = b_end ? X264_MIN( h->i_threadslice_end*16 , h->param.i_height ) : mb_y*16 - 8;
-
-    if( b_measure_quality )
+    if( b_measure_quality && (h->param.analyse.b_psnr || h->param.analyse.b_ssim) )
     {
-        if( h->param.analyse.b_psnr )
-        {
-            uint64_t ssd_y = x264_pixel_ssd_wxh( &h->pixf,
-                h->fdec->plane[0] + min_y * h->fdec->i_stride[0], h->fdec->i_stride[0],
-                h->fenc->plane[0] + min_y * h->fenc->i_stride[0], h->fenc->i_stride[0],
-                h->param.i_width, max_y-min_y );
-            uint64_t ssd_u, ssd_v;
-            x264_pixel_ssd_nv12( &h->pixf,
-                h->fdec->plane[1] + (min_y>>1) * h->fdec->i_stride[1], h->fdec->i_stride[1],
-                h->fenc->plane[1] + (min_y>>1) * h->fenc->i_stride[1], h->fenc->i_stride[1],
-                h->param.i_width>>1, (max_y-min_y)>>1, &ssd_u, &ssd_v );
-            h->stat.frame.i_ssd[0] += ssd_y;
-            h->stat.frame.i_ssd[1] += ssd_u;
-            h->stat.frame.i_ssd[2] += ssd_v;
-        }
-
-        if( h->param.analyse.b_ssim )
-        {
-            x264_emms();
-            /* offset by 2 pixels to avoid alignment of ssim blocks with dct blocks,
-             * and overlap by 4 */
-            min_y += b_start ? 2 : -6;
-            h->stat.frame.f_ssim +=
-                x264_pixel_ssim_wxh( &h->pixf,
-                    h->fdec->plane[0] + 2+min_y*h->fdec->i_stride[0], h->fdec->i_stride[0],
-                    h->fenc->plane[0] + 2+min_y*h->fenc->i_stride[0], h->fenc->i_stride[0],
-                    h->param.i_width-2, max_y-min_y, h->scratch_buffer );
-        }
+        min_y = min_y*16 - 8 * !b_start;
+        max_y = b_end ? X264_MIN( h->i_threadslice_end*16 , h->param.i_height ) : mb_y*16 - 8;
+        x264_fdec_measure_rows( h, min_y, max_y, b_start );
     }
 }
 
@@ -2037,11 +2160,14 @@ static int x264_slice_write( x264_t *h )
         /* load cache */
         x264_macroblock_cache_load( h, i_mb_x, i_mb_y );
 
+        TIMER_START( mb_timer );
         x264_macroblock_analyse( h );
+        TIMER_STOP( h, X264_TIMING_ANALYSE, mb_timer );
 
         /* encode this macroblock -> be careful it can change the mb type to P_SKIP if needed */
 reencode:
         x264_macroblock_encode( h );
+        TIMER_STOP( h, X264_TIMING_ENCODE, mb_timer );
 
         if( h->param.b_cabac )
         {
@@ -2084,6 +2210,7 @@ reencode:
                 }
             }
         }
+        TIMER_STOP( h, X264_TIMING_BITSTREAM, mb_timer );
 
         int total_bits = bs_pos(&h->out.bs) + x264_cabac_pos(&h->cabac);
         int mb_size = total_bits - mb_spos;
@@ -2309,6 +2436,12 @@ static void *x264_slices_write( x264_t *h )
         h->sh.i_first_mb = h->sh.i_last_mb + 1;
     }
 
+    if( h->metricspool )
+    {
+        x264_threadpool_run( h->metricspool, (void*)x264_fdec_measure_frame, h );
+        h->b_metrics_active = 1;
+    }
+
 #if HAVE_VISUALIZE
     if( h->param.b_visualize )
     {
@@ -2415,6 +2548,32 @@ int x264_encoder_invalidate_reference( x264_t *h, int64_t pts )
     return 0;
 }
 
+/****************************************************************************
+ * x264_encoder_timing:
+ ****************************************************************************/
+int x264_encoder_timing( x264_t *h, x264_timing_t *timing )
+{
+    memset( timing, 0, sizeof(x264_timing_t) );
+#if HAVE_TIMING
+    /* calibrate the timer against mdate over the lifetime of the encoder */
+    int64_t ticks = x264_timer_read() - h->i_timer_start;
+    int64_t usecs = x264_mdate() - h->i_mdate_start;
+    double scale = ticks > 0 ? (double)usecs / ticks : 0;
+    int threads = h->param.i_threads + !!h->param.i_sync_lookahead;
+    for( int i = 0; i < threads; i++ )
+        for( int j = 0; j < X264_TIMING_MAX; j++ )
+        {
+            timing->i_time[j] += h->thread[i]->timing.i_time[j];
+            timing->i_count[j] += h->thread[i]->timing.i_count[j];
+        }
+    for( int j = 0; j < X264_TIMING_MAX; j++ )
+        timing->i_time[j] *= scale;
+    return 0;
+#else
+    return -1;
+#endif
+}
+
 /****************************************************************************
  * x264_encoder_encode:
  *  XXX: i_poc   : is the poc of the current given picture
@@ -2473,6 +2632,8 @@ int     x264_encoder_encode( x264_t *h,
         x264_frame_t *fenc = x264_frame_pop_unused( h, 0 );
         if( !fenc )
             return -1;
+        if( h->framelog )
+            fenc->i_time_input = x264_mdate();
 
         if( x264_frame_copy_picture( h, fenc, pic_in ) < 0 )
             return -1;
@@ -2553,6 +2714,8 @@ int     x264_encoder_encode( x264_t *h,
     /* ------------------- Get frame to be encoded ------------------------- */
     /* 4: get picture to encode */
     h->fenc = x264_frame_shift( h->frames.current );
+    if( h->framelog )
+        h->fenc->i_time_encode = x264_mdate();
     if( h->i_frame == h->i_thread_frames - 1 )
         h->i_reordered_pts_delay = h->fenc->i_reordered_pts;
     if( h->fenc->param )
@@ -2657,6 +2820,9 @@ int     x264_encoder_encode( x264_t *h,
     /* build ref list 0/1 */
     x264_reference_build_list( h, h->fdec->i_poc );
 
+    if( h->i_thread_frames > 1 )
+        x264_mv_range_thread_update( h );
+
     /* ---------------------- Write the bitstream -------------------------- */
     /* Init bitstream context */
     if( h->param.b_sliced_threads )
@@ -2887,6 +3053,11 @@ static int x264_encoder_frame_end( x264_t *h, x264_t *thread_current,
         if( (intptr_t)x264_threadpool_wait( h->threadpool, h ) )
             return -1;
     }
+    if( h->b_metrics_active )
+    {
+        h->b_metrics_active = 0;
+        x264_threadpool_wait( h->metricspool, h );
+    }
     if( !h->out.i_nal )
     {
         pic_out->i_type = X264_TYPE_AUTO;
@@ -3022,8 +3193,18 @@ static int x264_encoder_frame_end( x264_t *h, x264_t *thread_current,
     }
     else
         h->stat.i_consecutive_bframes[h->fenc->i_bframes]++;
+    if( h->i_thread_frames > 1 && h->sh.i_type != SLICE_TYPE_I )
+    {
+        h->stat.i_stall_frames += !!h->stat.frame.i_stall_time;
+        h->stat.i_stall_time += h->stat.frame.i_stall_time;
+        for( int i_list = 0; i_list < 2; i_list++ )
+            for( int i = 0; i < X264_REF_MAX*2; i++ )
+                h->stat.i_stall_ref[i_list][i] += h->stat.frame.i_stall_ref[i_list][i];
+        h->stat.i_mv_range_thread += h->i_mv_range_thread;
+    }
 
     psz_message[0] = '\0';
+    double psnr[4], ssim = -1;
     double dur = h->fenc->f_duration;
     h->stat.f_frame_duration[h->sh.i_type] += dur;
     if( h->param.analyse.b_psnr )
@@ -3041,10 +3222,11 @@ static int x264_encoder_frame_end( x264_t *h, x264_t *thread_current,
         h->stat.f_psnr_mean_u[h->sh.i_type]  += dur * x264_psnr( ssd[1], h->param.i_width * h->param.i_height / 4 );
         h->stat.f_psnr_mean_v[h->sh.i_type]  += dur * x264_psnr( ssd[2], h->param.i_width * h->param.i_height / 4 );
 
-        snprintf( psz_message, 80, " PSNR Y:%5.2f U:%5.2f V:%5.2f",
-                  x264_psnr( ssd[0], h->param.i_width * h->param.i_height ),
-                  x264_psnr( ssd[1], h->param.i_width * h->param.i_height / 4),
-                  x264_psnr( ssd[2], h->param.i_width * h->param.i_height / 4) );
+        psnr[0] = x264_psnr( ssd[0], h->param.i_width * h->param.i_height );
+        psnr[1] = x264_psnr( ssd[1], h->param.i_width * h->param.i_height / 4 );
+        psnr[2] = x264_psnr( ssd[2], h->param.i_width * h->param.i_height / 4 );
+        psnr[3] = x264_psnr( ssd[0] + ssd[1] + ssd[2], 3 * h->param.i_width * h->param.i_height / 2 );
+        snprintf( psz_message, 80, " PSNR Y:%5.2f U:%5.2f V:%5.2f", psnr[0], psnr[1], psnr[2] );
     }
 
     if( h->param.analyse.b_ssim )
@@ -3052,9 +3234,13 @@ static int x264_encoder_frame_end( x264_t *h, x264_t *thread_current,
         double ssim_y = h->stat.frame.f_ssim
                       / (((h->param.i_width-6)>>2) * ((h->param.i_height-6)>>2));
         h->stat.f_ssim_mean_y[h->sh.i_type] += ssim_y * dur;
+        ssim = ssim_y;
         snprintf( psz_message + strlen(psz_message), 80 - strlen(psz_message),
                   " SSIM Y:%.5f", ssim_y );
     }
+    if( h->i_thread_frames > 1 && h->sh.i_type != SLICE_TYPE_I )
+        snprintf( psz_message + strlen(psz_message), 80 - strlen(psz_message),
+                  " mvrange:%d stall:%.1fms", h->i_mv_range_thread, h->stat.frame.i_stall_time / 1000. );
     psz_message[79] = '\0';
 
     x264_log( h, X264_LOG_DEBUG,
@@ -3070,6 +3256,9 @@ static int x264_encoder_frame_end( x264_t *h, x264_t *thread_current,
               frame_size,
               psz_message );
 
+    if( h->framelog )
+        x264_frame_log_write( h, frame_size, h->param.analyse.b_psnr ? psnr : NULL, ssim );
+
     // keep stats all in one place
     x264_thread_sync_stat( h->thread[0], h );
     // for the use of the next frame
@@ -3132,9 +3321,17 @@ void    x264_encoder_close  ( x264_t *h )
                    || h->stat.i_mb_count[SLICE_TYPE_B][I_PCM];
 
     x264_lookahead_delete( h );
+    x264_frame_log_delete( h );
 
     if( h->param.i_threads > 1 )
         x264_threadpool_delete( h->threadpool );
+    if( h->metricspool )
+    {
+        for( int i = 0; i < h->i_thread_frames; i++ )
+            if( h->thread[i]->b_metrics_active )
+                x264_threadpool_wait( h->metricspool, h->thread[i] );
+        x264_threadpool_delete( h->metricspool );
+    }
     if( h->i_thread_frames > 1 )
     {
         for( int i = 0; i < h->i_thread_frames; i++ )
@@ -3376,6 +3573,29 @@ void    x264_encoder_close  ( x264_t *h )
                 x264_log( h, X264_LOG_INFO, "ref %c L%d:%s\n", "PB"[i_slice], i_list, buf );
             }
 
+        int i_inter_frames = h->stat.i_frame_count[SLICE_TYPE_P] + h->stat.i_frame_count[SLICE_TYPE_B];
+        if( h->i_thread_frames > 1 && i_inter_frames )
+        {
+            char stall_buf[2*(4+X264_REF_MAX*2*6)+1];
+            char *p = stall_buf;
+            for( int i_list = 0; i_list < 2 && h->stat.i_stall_time; i_list++ )
+            {
+                int i_max = -1;
+                for( int i = 0; i < X264_REF_MAX*2; i++ )
+                    if( h->stat.i_stall_ref[i_list][i] )
+                        i_max = i;
+                if( i_max < 0 )
+                    continue;
+                p += sprintf( p, " L%d:", i_list );
+                for( int i = 0; i <= i_max; i++ )
+                    p += sprintf( p, " %4.1f%%", 100. * h->stat.i_stall_ref[i_list][i] / h->stat.i_stall_time );
+            }
+            *p = '\0';
+            x264_log( h, X264_LOG_INFO, "thread stalls: %.1f%% of frames, %.3fs, avg mvrange %.1f%s\n",
+                      100. * h->stat.i_stall_frames / i_inter_frames, h->stat.i_stall_time / 1e6,
+                      (double)h->stat.i_mv_range_thread / i_inter_frames, stall_buf );
+        }
+
         if( h->param.analyse.b_ssim )
         {
             float ssim = SUM3( h->stat.f_ssim_mean_y ) / duration;
@@ -0,0 +1,182 @@
+/*****************************************************************************
+ * framelog.c: per-frame statistics log
+ *****************************************************************************
+ * Copyright (C) 2003-2011 x264 project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ * This program is also available under a commercial proprietary license.
+ * For more information, contact us at licensing@x264.com.
+ *****************************************************************************/
+
+#include "common/common.h"
+#include "ratecontrol.h"
+#include "framelog.h"
+
+/* Records are formatted into one of two buffers; a full buffer is handed to a
+ * writer thread while the encoder carries on filling the other one, so the
+ * encoding thread only blocks if the disk falls a whole buffer behind. */
+
+#define FRAME_LOG_BUFFER_SIZE (64*1024)
+#define FRAME_LOG_RECORD_MAX  512
+
+typedef struct
+{
+    struct x264_frame_log_t *log;
+    char *data;
+    int   i_size;
+} x264_frame_log_buffer_t;
+
+struct x264_frame_log_t
+{
+    FILE *fh;
+    int   b_json;
+    x264_frame_log_buffer_t buf[2];
+    int   i_buf;      /* buffer being filled */
+    int   b_pending;  /* the other buffer has been handed to the writer thread */
+    int   b_error;
+    x264_threadpool_t *pool;
+};
+
+static void *x264_frame_log_flush( x264_frame_log_buffer_t *b )
+{
+    if( b->i_size && fwrite( b->data, 1, b->i_size, b->log->fh ) != (size_t)b->i_size )
+        b->log->b_error = 1;
+    b->i_size = 0;
+    return NULL;
+}
+
+static void x264_frame_log_submit( x264_frame_log_t *log )
+{
+    x264_frame_log_buffer_t *b = &log->buf[log->i_buf];
+    if( log->pool )
+    {
+        /* the other buffer must be written out before it is refilled */
+        if( log->b_pending )
+            x264_threadpool_wait( log->pool, &log->buf[!log->i_buf] );
+        x264_threadpool_run( log->pool, (void*)x264_frame_log_flush, b );
+        log->b_pending = 1;
+        log->i_buf ^= 1;
+    }
+    else
+        x264_frame_log_flush( b );
+}
+
+static void x264_frame_log_printf( x264_frame_log_t *log, const char *fmt, ... )
+{
+    x264_frame_log_buffer_t *b = &log->buf[log->i_buf];
+    va_list arg;
+    va_start( arg, fmt );
+    int len = vsnprintf( b->data + b->i_size, FRAME_LOG_BUFFER_SIZE - b->i_size, fmt, arg );
+    va_end( arg );
+    b->i_size += X264_MIN( len, FRAME_LOG_BUFFER_SIZE - 1 - b->i_size );
+}
+
+int x264_frame_log_init( x264_t *h )
+{
+    x264_frame_log_t *log;
+    CHECKED_MALLOCZERO( log, sizeof(x264_frame_log_t) );
+    for( int i = 0; i < 2; i++ )
+    {
+        CHECKED_MALLOC( log->buf[i].data, FRAME_LOG_BUFFER_SIZE );
+        log->buf[i].log = log;
+    }
+    log->b_json = h->param.i_frame_log_format == X264_FRAME_LOG_JSON;
+    log->fh = fopen( h->param.psz_frame_log, "wb" );
+    if( !log->fh )
+    {
+        x264_log( h, X264_LOG_ERROR, "frame log: can't write to %s\n", h->param.psz_frame_log );
+        goto fail;
+    }
+    if( x264_threadpool_init( &log->pool, 1, NULL, NULL ) )
+        log->pool = NULL;
+
+    if( !log->b_json )
+        x264_frame_log_printf( log, "frame,input,type,pts,qp_rc,qp_aq,bits,psnr_y,psnr_u,psnr_v,psnr_avg,ssim,"
+                                    "encode_ms,lookahead_ms,vbv_fill\n" );
+
+    for( int i = 0; i < h->param.i_threads + !!h->param.i_sync_lookahead; i++ )
+        h->thread[i]->framelog = log;
+    return 0;
+fail:
+    if( log )
+        for( int i = 0; i < 2; i++ )
+            x264_free( log->buf[i].data );
+    x264_free( log );
+    return -1;
+}
+
+void x264_frame_log_write( x264_t *h, int frame_size, double *psnr, double ssim )
+{
+    x264_frame_log_t *log = h->framelog;
+    const char *null = log->b_json ? "null" : "";
+    char psnr_str[4][16], ssim_str[16], vbv_str[16];
+    int64_t now = x264_mdate();
+    double vbv = x264_ratecontrol_vbv_fullness( h );
+    char c_type = h->fenc->i_type == X264_TYPE_IDR ? 'I'
+                : h->sh.i_type == SLICE_TYPE_I ? 'i'
+                : h->sh.i_type == SLICE_TYPE_P ? 'P'
+                : h->fenc->b_kept_as_ref ? 'B' : 'b';
+
+    for( int i = 0; i < 4; i++ )
+        if( psnr )
+            snprintf( psnr_str[i], 16, "%.3f", psnr[i] );
+        else
+            strcpy( psnr_str[i], null );
+    if( ssim >= 0 )
+        snprintf( ssim_str, 16, "%.6f", ssim );
+    else
+        strcpy( ssim_str, null );
+    if( vbv >= 0 )
+        snprintf( vbv_str, 16, "%.4f", vbv );
+    else
+        strcpy( vbv_str, null );
+
+    if( log->b_json )
+        x264_frame_log_printf( log, "{\"frame\":%d,\"input\":%d,\"type\":\"%c\",\"pts\":%"PRId64",\"qp_rc\":%.2f,\"qp_aq\":%.2f,"
+                                    "\"bits\":%d,\"psnr_y\":%s,\"psnr_u\":%s,\"psnr_v\":%s,\"psnr_avg\":%s,\"ssim\":%s,"
+                                    "\"encode_ms\":%.3f,\"lookahead_ms\":%.3f,\"vbv_fill\":%s}\n",
+                               h->i_frame, h->fenc->i_frame, c_type, h->fenc->i_pts, h->fdec->f_qp_avg_rc, h->fdec->f_qp_avg_aq,
+                               frame_size * 8, psnr_str[0], psnr_str[1], psnr_str[2], psnr_str[3], ssim_str,
+                               (now - h->fenc->i_time_encode) / 1000., (h->fenc->i_time_encode - h->fenc->i_time_input) / 1000.,
+                               vbv_str );
+    else
+        x264_frame_log_printf( log, "%d,%d,%c,%"PRId64",%.2f,%.2f,%d,%s,%s,%s,%s,%s,%.3f,%.3f,%s\n",
+                               h->i_frame, h->fenc->i_frame, c_type, h->fenc->i_pts, h->fdec->f_qp_avg_rc, h->fdec->f_qp_avg_aq,
+                               frame_size * 8, psnr_str[0], psnr_str[1], psnr_str[2], psnr_str[3], ssim_str,
+                               (now - h->fenc->i_time_encode) / 1000., (h->fenc->i_time_encode - h->fenc->i_time_input) / 1000.,
+                               vbv_str );
+
+    if( log->buf[log->i_buf].i_size > FRAME_LOG_BUFFER_SIZE - FRAME_LOG_RECORD_MAX )
+        x264_frame_log_submit( log );
+}
+
+void x264_frame_log_delete( x264_t *h )
+{
+    x264_frame_log_t *log = h->framelog;
+    if( !log )
+        return;
+    if( log->buf[log->i_buf].i_size )
+        x264_frame_log_submit( log );
+    if( log->b_pending )
+        x264_threadpool_wait( log->pool, &log->buf[!log->i_buf] );
+    if( log->pool )
+        x264_threadpool_delete( log->pool );
+    if( fclose( log->fh ) || log->b_error )
+        x264_log( h, X264_LOG_ERROR, "frame log: error writing %s\n", h->param.psz_frame_log );
+    for( int i = 0; i < 2; i++ )
+        x264_free( log->buf[i].data );
+    x264_free( log );
+}
@@ -0,0 +1,32 @@
+/*****************************************************************************
+ * framelog.h: per-frame statistics log
+ *****************************************************************************
+ * Copyright (C) 2003-2011 x264 project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ * This program is also available under a commercial proprietary license.
+ * For more information, contact us at licensing@x264.com.
+ *****************************************************************************/
+
+#ifndef X264_ENCODER_FRAMELOG_H
+#define X264_ENCODER_FRAMELOG_H
+
+int  x264_frame_log_init( x264_t *h );
+/* psnr is NULL and ssim negative when not measured */
+void x264_frame_log_write( x264_t *h, int frame_size, double *psnr, double ssim );
+void x264_frame_log_delete( x264_t *h );
+
+#endif
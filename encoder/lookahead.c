@@ -39,21 +39,29 @@
 #include "common/common.h"
 #include "analyse.h"
 
+/* Drop the first count frames of a list, keeping the rest NULL-terminated.
+ * Done as one move rather than a x264_frame_shift per frame. */
+static void x264_lookahead_drop( x264_sync_frame_list_t *slist, int count )
+{
+    slist->i_size -= count;
+    memmove( slist->list, slist->list + count, slist->i_size * sizeof(x264_frame_t*) );
+    memset( slist->list + slist->i_size, 0, count * sizeof(x264_frame_t*) );
+}
+
+/* The lists stay mutex-protected arrays rather than rings: slicetype indexes
+ * next.list in place, so it has to be contiguous, and the waits use the same
+ * condition variables on every thread backend. */
 static void x264_lookahead_shift( x264_sync_frame_list_t *dst, x264_sync_frame_list_t *src, int count )
 {
-    int i = count;
-    while( i-- )
-    {
-        assert( dst->i_size < dst->i_max_size );
-        assert( src->i_size );
-        dst->list[ dst->i_size++ ] = x264_frame_shift( src->list );
-        src->i_size--;
-    }
-    if( count )
-    {
-        x264_pthread_cond_broadcast( &dst->cv_fill );
-        x264_pthread_cond_broadcast( &src->cv_empty );
-    }
+    if( !count )
+        return;
+    assert( dst->i_size + count <= dst->i_max_size );
+    assert( src->i_size >= count );
+    memcpy( dst->list + dst->i_size, src->list, count * sizeof(x264_frame_t*) );
+    dst->i_size += count;
+    x264_lookahead_drop( src, count );
+    x264_pthread_cond_broadcast( &dst->cv_fill );
+    x264_pthread_cond_broadcast( &src->cv_empty );
 }
 
 static void x264_lookahead_update_last_nonb( x264_t *h, x264_frame_t *new_nonb )
@@ -67,7 +75,9 @@ static void x264_lookahead_update_last_nonb( x264_t *h, x264_frame_t *new_nonb )
 #if HAVE_THREAD
 static void x264_lookahead_slicetype_decide( x264_t *h )
 {
+    TIMER_START( slicetype_timer );
     x264_stack_align( x264_slicetype_decide, h );
+    TIMER_STOP( h, X264_TIMING_SLICETYPE, slicetype_timer );
 
     x264_lookahead_update_last_nonb( h, h->lookahead->next.list[0] );
 
@@ -81,7 +91,11 @@ static void x264_lookahead_slicetype_decide( x264_t *h )
 
     /* For MB-tree and VBV lookahead, we have to perform propagation analysis on I-frames too. */
     if( h->lookahead->b_analyse_keyframe && IS_X264_TYPE_I( h->lookahead->last_nonb->i_type ) )
+    {
+        TIMER_START( analyse_timer );
         x264_stack_align( x264_slicetype_analyse, h, 1 );
+        TIMER_STOP( h, X264_TIMING_SLICETYPE, analyse_timer );
+    }
 
     x264_pthread_mutex_unlock( &h->lookahead->ofbuf.mutex );
 }
@@ -96,10 +110,15 @@ static void x264_lookahead_thread( x264_t *h )
     while( !h->lookahead->b_exit_thread )
     {
         x264_pthread_mutex_lock( &h->lookahead->ifbuf.mutex );
-        x264_pthread_mutex_lock( &h->lookahead->next.mutex );
+        /* next is only resized by this thread, so its lock is only needed
+         * (against x264_lookahead_is_empty) when frames actually move */
         shift = X264_MIN( h->lookahead->next.i_max_size - h->lookahead->next.i_size, h->lookahead->ifbuf.i_size );
-        x264_lookahead_shift( &h->lookahead->next, &h->lookahead->ifbuf, shift );
-        x264_pthread_mutex_unlock( &h->lookahead->next.mutex );
+        if( shift )
+        {
+            x264_pthread_mutex_lock( &h->lookahead->next.mutex );
+            x264_lookahead_shift( &h->lookahead->next, &h->lookahead->ifbuf, shift );
+            x264_pthread_mutex_unlock( &h->lookahead->next.mutex );
+        }
         if( h->lookahead->next.i_size <= h->lookahead->i_slicetype_length + h->param.b_vfr_input )
         {
             while( !h->lookahead->ifbuf.i_size && !h->lookahead->b_exit_thread )
@@ -144,6 +163,15 @@ int x264_lookahead_init( x264_t *h, int i_slicetype_length )
         x264_sync_frame_list_init( &look->ofbuf, h->frames.i_delay+3 ) )
         goto fail;
 
+    for( int i = 0; i < h->param.rc.i_lookahead_pyramid; i++ )
+    {
+        int blocks = ((h->mb.i_mb_width + (2<<i) - 1) >> (i+1)) * ((h->mb.i_mb_height + (2<<i) - 1) >> (i+1));
+        CHECKED_MALLOC( look->pyramid_mvs[i], blocks * sizeof(*look->pyramid_mvs[i]) );
+    }
+
+    if( x264_slicetype_threads_init( h ) )
+        goto fail;
+
     if( !h->param.i_sync_lookahead )
         return 0;
 
@@ -178,11 +206,14 @@ void x264_lookahead_delete( x264_t *h )
         x264_macroblock_thread_free( h->thread[h->param.i_threads], 1 );
         x264_free( h->thread[h->param.i_threads] );
     }
+    x264_slicetype_threads_delete( h );
     x264_sync_frame_list_delete( &h->lookahead->ifbuf );
     x264_sync_frame_list_delete( &h->lookahead->next );
     if( h->lookahead->last_nonb )
         x264_frame_push_unused( h, h->lookahead->last_nonb );
     x264_sync_frame_list_delete( &h->lookahead->ofbuf );
+    x264_free( h->lookahead->pyramid_mvs[0] );
+    x264_free( h->lookahead->pyramid_mvs[1] );
     x264_free( h->lookahead );
 }
 
@@ -209,11 +240,9 @@ static void x264_lookahead_encoder_shift( x264_t *h )
     if( !h->lookahead->ofbuf.i_size )
         return;
     int i_frames = h->lookahead->ofbuf.list[0]->i_bframes + 1;
-    while( i_frames-- )
-    {
-        x264_frame_push( h->frames.current, x264_frame_shift( h->lookahead->ofbuf.list ) );
-        h->lookahead->ofbuf.i_size--;
-    }
+    for( int i = 0; i < i_frames; i++ )
+        x264_frame_push( h->frames.current, h->lookahead->ofbuf.list[i] );
+    x264_lookahead_drop( &h->lookahead->ofbuf, i_frames );
     x264_pthread_cond_broadcast( &h->lookahead->ofbuf.cv_empty );
 }
 
@@ -221,9 +250,11 @@ void x264_lookahead_get_frames( x264_t *h )
 {
     if( h->param.i_sync_lookahead )
     {   /* We have a lookahead thread, so get frames from there */
+        TIMER_START( wait_timer );
         x264_pthread_mutex_lock( &h->lookahead->ofbuf.mutex );
         while( !h->lookahead->ofbuf.i_size && h->lookahead->b_thread_active )
             x264_pthread_cond_wait( &h->lookahead->ofbuf.cv_fill, &h->lookahead->ofbuf.mutex );
+        TIMER_STOP( h, X264_TIMING_WAIT_LOOKAHEAD, wait_timer );
         x264_lookahead_encoder_shift( h );
         x264_pthread_mutex_unlock( &h->lookahead->ofbuf.mutex );
     }
@@ -233,6 +264,7 @@ void x264_lookahead_get_frames( x264_t *h )
         if( h->frames.current[0] || !h->lookahead->next.i_size )
             return;
 
+        TIMER_START( slicetype_timer );
         x264_stack_align( x264_slicetype_decide, h );
         x264_lookahead_update_last_nonb( h, h->lookahead->next.list[0] );
         x264_lookahead_shift( &h->lookahead->ofbuf, &h->lookahead->next, h->lookahead->next.list[0]->i_bframes + 1 );
@@ -240,6 +272,7 @@ void x264_lookahead_get_frames( x264_t *h )
         /* For MB-tree and VBV lookahead, we have to perform propagation analysis on I-frames too. */
         if( h->lookahead->b_analyse_keyframe && IS_X264_TYPE_I( h->lookahead->last_nonb->i_type ) )
             x264_stack_align( x264_slicetype_analyse, h, 1 );
+        TIMER_STOP( h, X264_TIMING_SLICETYPE, slicetype_timer );
 
         x264_lookahead_encoder_shift( h );
     }
@@ -56,6 +56,25 @@ static const int8_t square1[9][2] = {{0,0}, {0,-1}, {0,1}, {-1,0}, {1,0}, {-1,-1
 
 static void refine_subpel( x264_t *h, x264_me_t *m, int hpel_iters, int qpel_iters, int *p_halfpel_thresh, int b_refine_qpel );
 
+/* Second level of successive elimination for the ads survivors: the sums of
+ * the 4x4 blocks bound the SAD (not the SATD) more tightly than those of the
+ * 8x8 blocks, for a fraction of the cost of the SAD itself.  Compacts xs in place. */
+static int x264_ads_dc4( int *enc_dc4, uint16_t *sums4, const int *offs, int n,
+                         uint16_t *cost_mvx, int16_t *xs, int xn, int thresh )
+{
+    int nmv = 0;
+    for( int i = 0; i < xn; i++ )
+    {
+        uint16_t *sums = sums4 + xs[i];
+        int ads = cost_mvx[xs[i]];
+        for( int j = 0; j < n; j++ )
+            ads += abs( enc_dc4[j] - sums[offs[j]] );
+        xs[nmv] = xs[i];
+        nmv += ads < thresh;
+    }
+    return nmv;
+}
+
 #define BITS_MVD( mx, my )\
     (p_cost_mvx[(mx)<<2] + p_cost_mvy[(my)<<2])
 
@@ -123,19 +142,22 @@ static void refine_subpel( x264_t *h, x264_me_t *m, int hpel_iters, int qpel_ite
     COPY3_IF_LT( bcost, costs[3], bmx, omx+(m3x), bmy, omy+(m3y) );\
 }
 
-#define COST_MV_X3_ABS( m0x, m0y, m1x, m1y, m2x, m2y )\
+#define COST_MV_X4_ABS( m0x, m0y, m1x, m1y, m2x, m2y, m3x, m3y )\
 {\
-    h->pixf.fpelcmp_x3[i_pixel]( p_fenc,\
+    h->pixf.fpelcmp_x4[i_pixel]( p_fenc,\
         p_fref_w + (m0x) + (m0y)*stride,\
         p_fref_w + (m1x) + (m1y)*stride,\
         p_fref_w + (m2x) + (m2y)*stride,\
+        p_fref_w + (m3x) + (m3y)*stride,\
         stride, costs );\
     costs[0] += p_cost_mvx[(m0x)<<2]; /* no cost_mvy */\
     costs[1] += p_cost_mvx[(m1x)<<2];\
     costs[2] += p_cost_mvx[(m2x)<<2];\
+    costs[3] += p_cost_mvx[(m3x)<<2];\
     COPY3_IF_LT( bcost, costs[0], bmx, m0x, bmy, m0y );\
     COPY3_IF_LT( bcost, costs[1], bmx, m1x, bmy, m1y );\
     COPY3_IF_LT( bcost, costs[2], bmx, m2x, bmy, m2y );\
+    COPY3_IF_LT( bcost, costs[3], bmx, m3x, bmy, m3y );\
 }
 
 /*  1  */
@@ -624,12 +646,12 @@ void x264_me_search_ref( x264_t *h, x264_me_t *m, int16_t (*mvc)[2], int i_mvc,
                     bsad -= ycost;
                     xn = h->pixf.ads[i_pixel]( enc_dc, sums_base + min_x + my * stride, delta,
                                                cost_fpel_mvx+min_x, xs, width, bsad * 17 >> 4 );
-                    for( i = 0; i < xn-2; i += 3 )
+                    for( i = 0; i < xn-3; i += 4 )
                     {
                         pixel *ref = p_fref_w+min_x+my*stride;
-                        int sads[3];
-                        h->pixf.sad_x3[i_pixel]( p_fenc, ref+xs[i], ref+xs[i+1], ref+xs[i+2], stride, sads );
-                        for( int j = 0; j < 3; j++ )
+                        int sads[4];
+                        h->pixf.sad_x4[i_pixel]( p_fenc, ref+xs[i], ref+xs[i+1], ref+xs[i+2], ref+xs[i+3], stride, sads );
+                        for( int j = 0; j < 4; j++ )
                         {
                             int sad = sads[j] + cost_fpel_mvx[xs[i+j]];
                             if( sad < bsad*sad_thresh>>3 )
@@ -706,6 +728,30 @@ void x264_me_search_ref( x264_t *h, x264_me_t *m, int16_t (*mvc)[2], int i_mvc,
             else
             {
                 // just ADS and SAD
+                /* When the integral image also has the 4x4 sums, the ads survivors
+                 * are checked against those before the full fpelcmp.  The threshold
+                 * is the cost that has to be beaten, so with SAD as fpelcmp this
+                 * doesn't change the result.  With SATD (subme > 1) the sums are no
+                 * lower bound, so like the 8x8 ads level it is only a heuristic.
+                 * Weighted refs skip it, since their pixels don't match the sums.
+                 * (TESA's SAD threshold is too loose for this to pay off.) */
+                ALIGNED_ARRAY_16( int, enc_dc4,[16] );
+                int dc4_offs[16];
+                int n_dc4 = 0;
+                uint16_t *sums4_base = m->integral + stride * (h->fenc->i_lines[0] + PADV*2);
+                if( h->frames.b_have_sub8x8_esa && sad_size == PIXEL_8x8 && p_fref_w == m->p_fref[0] )
+                    for( int y = 0; y < x264_pixel_size[i_pixel].h; y += 8 )
+                        for( int x = 0; x < x264_pixel_size[i_pixel].w; x += 8, n_dc4 += 4 )
+                        {
+                            pixel *enc = p_fenc + x + y*FENC_STRIDE;
+                            h->pixf.sad_x4[PIXEL_4x4]( zero, enc, enc+4, enc+4*FENC_STRIDE, enc+4+4*FENC_STRIDE,
+                                                       FENC_STRIDE, enc_dc4+n_dc4 );
+                            dc4_offs[n_dc4+0] = x   +  y   *stride;
+                            dc4_offs[n_dc4+1] = x+4 +  y   *stride;
+                            dc4_offs[n_dc4+2] = x   + (y+4)*stride;
+                            dc4_offs[n_dc4+3] = x+4 + (y+4)*stride;
+                        }
+
                 for( int my = min_y; my <= max_y; my++ )
                 {
                     int i;
@@ -715,8 +761,11 @@ void x264_me_search_ref( x264_t *h, x264_me_t *m, int16_t (*mvc)[2], int i_mvc,
                     bcost -= ycost;
                     xn = h->pixf.ads[i_pixel]( enc_dc, sums_base + min_x + my * stride, delta,
                                                cost_fpel_mvx+min_x, xs, width, bcost );
-                    for( i = 0; i < xn-2; i += 3 )
-                        COST_MV_X3_ABS( min_x+xs[i],my, min_x+xs[i+1],my, min_x+xs[i+2],my );
+                    if( n_dc4 )
+                        xn = x264_ads_dc4( enc_dc4, sums4_base + min_x + my * stride, dc4_offs, n_dc4,
+                                           cost_fpel_mvx+min_x, xs, xn, bcost );
+                    for( i = 0; i < xn-3; i += 4 )
+                        COST_MV_X4_ABS( min_x+xs[i],my, min_x+xs[i+1],my, min_x+xs[i+2],my, min_x+xs[i+3],my );
                     bcost += ycost;
                     for( ; i < xn; i++ )
                         COST_MV( min_x+xs[i], my );
@@ -1864,6 +1864,15 @@ void x264_hrd_fullness( x264_t *h )
     h->initial_cpb_removal_delay_offset = (multiply_factor * cpb_size + denom) / (2*denom) - h->initial_cpb_removal_delay;
 }
 
+/* fraction of the vbv buffer filled after the last finished frame, -1 without vbv */
+double x264_ratecontrol_vbv_fullness( x264_t *h )
+{
+    x264_ratecontrol_t *rct = h->thread[0]->rc;
+    if( !rct->b_vbv )
+        return -1;
+    return (double)rct->buffer_fill_final / ((uint64_t)h->sps->vui.hrd.i_cpb_size_unscaled * h->sps->vui.i_time_scale);
+}
+
 // provisionally update VBV according to the planned size of all frames currently in progress
 static void update_vbv_plan( x264_t *h, int overhead )
 {
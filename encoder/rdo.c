@@ -430,8 +430,12 @@ int quant_trellis_cabac( x264_t *h, dctcoef *dct,
     uint8_t *cabac_state_sig = &h->cabac.state[ significant_coeff_flag_offset[b_interlaced][ctx_block_cat] ];
     uint8_t *cabac_state_last = &h->cabac.state[ last_coeff_flag_offset[b_interlaced][ctx_block_cat] ];
     const int f = 1 << 15; // no deadzone
+    const int b_psy = h->mb.i_psy_trellis && !dc && ctx_block_cat != DCT_CHROMA_AC;
     int i_last_nnz;
     int i;
+    /* bitmask of the nodes whose score isn't TRELLIS_SCORE_MAX, so that
+     * dead cabac states can be skipped without touching them. */
+    int live;
 
     // (# of coefs) * (# of ctx) * (# of levels tried) = 1024
     // we don't need to keep all of those: (# of coefs) * (# of ctx) would be enough,
@@ -471,6 +475,7 @@ int quant_trellis_cabac( x264_t *h, dctcoef *dct,
         nodes_cur[j].score = TRELLIS_SCORE_MAX;
     nodes_cur[0].score = 0;
     nodes_cur[0].level_idx = 0;
+    live = 1;
     level_tree[0].abs_level = 0;
     level_tree[0].next = 0;
 
@@ -499,19 +504,17 @@ int quant_trellis_cabac( x264_t *h, dctcoef *dct,
             int sigindex = i_coefs == 64 ? significant_coeff_flag_offset_8x8[b_interlaced][i] : i;
             const uint32_t cost_sig0 = x264_cabac_size_decision_noup2( &cabac_state_sig[sigindex], 0 )
                                      * (uint64_t)i_lambda2 >> ( CABAC_SIZE_BITS - LAMBDA_BITS );
-            for( int j = 1; j < 8; j++ )
+            for( int mask = live & ~1; mask; mask &= mask-1 )
             {
-                if( nodes_cur[j].score != TRELLIS_SCORE_MAX )
-                {
+                int j = x264_ctz( mask );
 #define SET_LEVEL(n,l) \
-                    level_tree[i_levels_used].abs_level = l; \
-                    level_tree[i_levels_used].next = n.level_idx; \
-                    n.level_idx = i_levels_used; \
-                    i_levels_used++;
+                level_tree[i_levels_used].abs_level = l; \
+                level_tree[i_levels_used].next = n.level_idx; \
+                n.level_idx = i_levels_used; \
+                i_levels_used++;
 
-                    SET_LEVEL( nodes_cur[j], 0 );
-                    nodes_cur[j].score += cost_sig0;
-                }
+                SET_LEVEL( nodes_cur[j], 0 );
+                nodes_cur[j].score += cost_sig0;
             }
             continue;
         }
@@ -520,6 +523,16 @@ int quant_trellis_cabac( x264_t *h, dctcoef *dct,
 
         for( int j = 0; j < 8; j++ )
             nodes_cur[j].score = TRELLIS_SCORE_MAX;
+        int live_prev = live;
+        live = 0;
+
+        int predicted_coef = 0, psy_weight = 0;
+        if( b_psy && i )
+        {
+            int orig_coef = (i_coefs == 64) ? h->mb.pic.fenc_dct8[idx][zigzag[i]] : h->mb.pic.fenc_dct4[idx][zigzag[i]];
+            predicted_coef = orig_coef - i_coef * signs[i];
+            psy_weight = (i_coefs == 64) ? x264_dct8_weight_tab[zigzag[i]] : x264_dct4_weight_tab[zigzag[i]];
+        }
 
         if( i < i_coefs-1 )
         {
@@ -546,23 +559,19 @@ int quant_trellis_cabac( x264_t *h, dctcoef *dct,
             int d = i_coef - unquant_abs_level;
             int64_t ssd;
             /* Psy trellis: bias in favor of higher AC coefficients in the reconstructed frame. */
-            if( h->mb.i_psy_trellis && i && !dc && ctx_block_cat != DCT_CHROMA_AC )
+            if( b_psy && i )
             {
-                int orig_coef = (i_coefs == 64) ? h->mb.pic.fenc_dct8[idx][zigzag[i]] : h->mb.pic.fenc_dct4[idx][zigzag[i]];
-                int predicted_coef = orig_coef - i_coef * signs[i];
                 int psy_value = h->mb.i_psy_trellis * abs(predicted_coef + unquant_abs_level * signs[i]);
-                int psy_weight = (i_coefs == 64) ? x264_dct8_weight_tab[zigzag[i]] : x264_dct4_weight_tab[zigzag[i]];
                 ssd = (int64_t)d*d * coef_weight[i] - psy_weight * psy_value;
             }
             else
             /* FIXME: for i16x16 dc is this weight optimal? */
                 ssd = (int64_t)d*d * (dc?256:coef_weight[i]);
 
-            for( int j = 0; j < 8; j++ )
+            for( int mask = live_prev; mask; mask &= mask-1 )
             {
+                int j = x264_ctz( mask );
                 int node_ctx = j;
-                if( nodes_prev[j].score == TRELLIS_SCORE_MAX )
-                    continue;
                 n = nodes_prev[j];
 
                 /* code the proposed level, and count how much entropy it would take */
@@ -606,6 +615,7 @@ int quant_trellis_cabac( x264_t *h, dctcoef *dct,
                 {
                     SET_LEVEL( n, abs_level );
                     nodes_cur[node_ctx] = n;
+                    live |= 1 << node_ctx;
                 }
             }
         }
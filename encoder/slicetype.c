@@ -43,7 +43,8 @@ static void x264_lowres_context_init( x264_t *h, x264_mb_analysis_t *a )
     x264_mb_analyse_load_costs( h, a );
     if( h->param.analyse.i_subpel_refine > 1 )
     {
-        h->mb.i_me_method = X264_MIN( X264_ME_HEX, h->param.analyse.i_me_method );
+        /* With the pyramid, the coarse levels find the large motion. */
+        h->mb.i_me_method = h->param.rc.i_lookahead_pyramid ? X264_ME_DIA : X264_MIN( X264_ME_HEX, h->param.analyse.i_me_method );
         h->mb.i_subpel_refine = 4;
     }
     else
@@ -183,42 +184,37 @@ static NOINLINE unsigned int x264_weight_cost_luma( x264_t *h, x264_frame_t *fen
     return cost;
 }
 
-static NOINLINE unsigned int x264_weight_cost_chroma( x264_t *h, x264_frame_t *fenc, pixel *ref, x264_weight_t *w )
+/* Sums of the 8x8 blocks of a plane. */
+static NOINLINE void x264_weight_block_sums( x264_t *h, pixel *plane, int i_stride, int i_width, int i_lines, int *sums )
 {
-    unsigned int cost = 0;
-    int i_stride = fenc->i_stride[1];
-    int i_offset = i_stride / 2;
-    int i_lines = fenc->i_lines[1];
-    int i_width = fenc->i_width[1];
-    pixel *src = ref + i_offset;
-    ALIGNED_ARRAY_16( pixel, buf, [8*8] );
-    int pixoff = 0;
-    ALIGNED_16( static pixel flat[8] ) = {0};
-    if( w )
-    {
-        for( int y = 0; y < i_lines; y += 8, pixoff = y*i_stride )
-            for( int x = 0; x < i_width; x += 8, pixoff += 8 )
-            {
-                w->weightfn[8>>2]( buf, 8, &ref[pixoff], i_stride, w, 8 );
-                /* The naive and seemingly sensible algorithm is to use mbcmp as in luma.
-                 * But testing shows that for chroma the DC coefficient is by far the most
-                 * important part of the coding cost.  Thus a more useful chroma weight is
-                 * obtained by comparing each block's DC coefficient instead of the actual
-                 * pixels.
-                 *
-                 * FIXME: add a (faster) asm sum function to replace sad. */
-                cost += abs( h->pixf.sad_aligned[PIXEL_8x8](          buf,        8, flat, 0 ) -
-                             h->pixf.sad_aligned[PIXEL_8x8]( &src[pixoff], i_stride, flat, 0 ) );
-            }
-        cost += x264_weight_slice_header_cost( h, w, 1 );
-    }
-    else
-        for( int y = 0; y < i_lines; y += 8, pixoff = y*i_stride )
-            for( int x = 0; x < i_width; x += 8, pixoff += 8 )
-                cost += abs( h->pixf.sad_aligned[PIXEL_8x8]( &ref[pixoff], i_stride, flat, 0 ) -
-                             h->pixf.sad_aligned[PIXEL_8x8]( &src[pixoff], i_stride, flat, 0 ) );
+    for( int y = 0; y < i_lines; y += 8, plane += 8*i_stride )
+        for( int x = 0; x < i_width; x += 8 )
+            *sums++ = (uint32_t)h->pixf.var[PIXEL_8x8]( plane+x, i_stride );
     x264_emms();
-    return cost;
+}
+
+/* The lowres block sums are kept with the frame: they are needed again when the
+ * frame becomes the reference of a later one. */
+static int *x264_weight_lowres_sums( x264_t *h, x264_frame_t *frame )
+{
+    if( frame->i_lowres_block_sum[0] < 0 )
+        x264_weight_block_sums( h, frame->lowres[0], frame->i_stride_lowres, frame->i_width_lowres,
+                                frame->i_lines_lowres, frame->i_lowres_block_sum );
+    return frame->i_lowres_block_sum;
+}
+
+/* Difference between the block sums of fenc and of the weighted ref, computed
+ * from the unweighted sums, i.e. ignoring rounding and clipping.  For chroma this
+ * is the whole cost: the DC coefficient is by far the most important part of the
+ * chroma coding cost, so comparing block DCs gives better chroma weights than
+ * comparing the pixels as in luma. */
+static uint64_t x264_weight_cost_dc( int *ref_sums, int *fenc_sums, int i_blocks, int scale, int denom, int offset )
+{
+    uint64_t cost = 0;
+    int64_t off = (int64_t)offset * ((64 << (BIT_DEPTH-8)) << denom);
+    for( int i = 0; i < i_blocks; i++ )
+        cost += llabs( (int64_t)ref_sums[i] * scale + off - ((int64_t)fenc_sums[i] << denom) );
+    return (cost + (1 << denom >> 1)) >> denom;
 }
 
 void x264_weights_analyse( x264_t *h, x264_frame_t *fenc, x264_frame_t *ref, int b_lookahead )
@@ -268,8 +264,46 @@ void x264_weights_analyse( x264_t *h, x264_frame_t *fenc, x264_frame_t *ref, int
         minscale = weights[plane].i_scale;
         minoff = 0;
 
-        pixel *mcbuf;
-        if( !plane )
+        // This gives a slight improvement due to rounding errors but only tests one offset in lookahead.
+        // Currently only searches within +/- 1 of the best offset found so far.
+        // TODO: Try other offsets/multipliers/combinations thereof?
+        cur_offset = fenc_mean - ref_mean * minscale / (1 << mindenom) + 0.5f * b_lookahead;
+        start_offset = x264_clip3( cur_offset - !b_lookahead, -128, 127 );
+        end_offset   = x264_clip3( cur_offset + !b_lookahead, -128, 127 );
+
+        int i_blocks = h->mb.i_mb_count;
+        if( plane )
+        {
+            /* Only initialize chroma data once.  The block sums are laid out as
+             * [U ref][U fenc][V ref][V fenc] in p_weight_sums. */
+            if( plane == 1 )
+            {
+                int i_stride = fenc->i_stride[1];
+                pixel *dstu = h->mb.p_weight_buf[0];
+                pixel *dstv = h->mb.p_weight_buf[0]+i_stride*fenc->i_lines[1];
+                x264_weight_cost_init_chroma( h, fenc, ref, dstu, dstv );
+                for( int i = 0; i < 4; i++ )
+                    x264_weight_block_sums( h, (i&2 ? dstv : dstu) + (i&1) * (i_stride/2), i_stride, fenc->i_width[1],
+                                            fenc->i_lines[1], h->mb.p_weight_sums + i*i_blocks );
+            }
+            int *ref_sums = h->mb.p_weight_sums + (plane-1)*2*i_blocks;
+            int *fenc_sums = ref_sums + i_blocks;
+            origscore = minscore = X264_MIN( x264_weight_cost_dc( ref_sums, fenc_sums, i_blocks, 1, 0, 0 ), UINT_MAX );
+            if( !minscore )
+                continue;
+            for( int i_off = start_offset; i_off <= end_offset; i_off++ )
+            {
+                SET_WEIGHT( weights[plane], 1, minscale, mindenom, i_off );
+                unsigned int s = X264_MIN( x264_weight_cost_dc( ref_sums, fenc_sums, i_blocks, minscale, mindenom, i_off ), UINT_MAX )
+                               + x264_weight_slice_header_cost( h, &weights[plane], 1 );
+                COPY3_IF_LT( minscore, s, minoff, i_off, found, 1 );
+
+                // Don't check any more offsets if the previous one had a lower cost than the current one
+                if( minoff == start_offset && i_off != start_offset )
+                    break;
+            }
+        }
+        else
         {
             if( !fenc->b_intra_calculated )
             {
@@ -277,42 +311,37 @@ void x264_weights_analyse( x264_t *h, x264_frame_t *fenc, x264_frame_t *ref, int
                 x264_lowres_context_init( h, &a );
                 x264_slicetype_frame_cost( h, &a, &fenc, 0, 0, 0, 0 );
             }
-            mcbuf = x264_weight_cost_init_luma( h, fenc, ref, h->mb.p_weight_buf[0] );
+            pixel *mcbuf = x264_weight_cost_init_luma( h, fenc, ref, h->mb.p_weight_buf[0] );
             origscore = minscore = x264_weight_cost_luma( h, fenc, mcbuf, NULL );
-        }
-        else
-        {
-            pixel *dstu = h->mb.p_weight_buf[0];
-            pixel *dstv = h->mb.p_weight_buf[0]+fenc->i_stride[1]*fenc->i_lines[1];
-            /* Only initialize chroma data once. */
-            if( plane == 1 )
-                x264_weight_cost_init_chroma( h, fenc, ref, dstu, dstv );
-            mcbuf = plane == 1 ? dstu : dstv;
-            origscore = minscore = x264_weight_cost_chroma( h, fenc, mcbuf, NULL );
-        }
-
-        if( !minscore )
-            continue;
-
-        // This gives a slight improvement due to rounding errors but only tests one offset in lookahead.
-        // Currently only searches within +/- 1 of the best offset found so far.
-        // TODO: Try other offsets/multipliers/combinations thereof?
-        cur_offset = fenc_mean - ref_mean * minscale / (1 << mindenom) + 0.5f * b_lookahead;
-        start_offset = x264_clip3( cur_offset - !b_lookahead, -128, 127 );
-        end_offset   = x264_clip3( cur_offset + !b_lookahead, -128, 127 );
-        for( int i_off = start_offset; i_off <= end_offset; i_off++ )
-        {
-            SET_WEIGHT( weights[plane], 1, minscale, mindenom, i_off );
-            unsigned int s;
-            if( plane )
-                s = x264_weight_cost_chroma( h, fenc, mcbuf, &weights[plane] );
-            else
-                s = x264_weight_cost_luma( h, fenc, mcbuf, &weights[plane] );
-            COPY3_IF_LT( minscore, s, minoff, i_off, found, 1 );
-
-            // Don't check any more offsets if the previous one had a lower cost than the current one
-            if( minoff == start_offset && i_off != start_offset )
-                break;
+            if( !minscore )
+                continue;
+            /* The block DC error of each candidate offset is cheap to get from the block
+             * sums, so only the two best by that measure get the full SATD check. */
+            int cand[3], i_cand = end_offset - start_offset + 1;
+            for( int i = 0; i < i_cand; i++ )
+                cand[i] = start_offset + i;
+            if( i_cand > 2 )
+            {
+                int *fenc_sums = x264_weight_lowres_sums( h, fenc );
+                int *ref_sums = h->mb.p_weight_sums;
+                if( mcbuf == ref->lowres[0] )
+                    ref_sums = x264_weight_lowres_sums( h, ref );
+                else
+                    x264_weight_block_sums( h, mcbuf, fenc->i_stride_lowres, fenc->i_width_lowres, fenc->i_lines_lowres, ref_sums );
+                uint64_t dc[3];
+                for( int i = 0; i < 3; i++ )
+                    dc[i] = x264_weight_cost_dc( ref_sums, fenc_sums, i_blocks, minscale, mindenom, cand[i] );
+                int worst = dc[0] > dc[1] ? (dc[0] > dc[2] ? 0 : 2) : (dc[1] > dc[2] ? 1 : 2);
+                for( int i = worst; i < 2; i++ )
+                    cand[i] = cand[i+1];
+                i_cand = 2;
+            }
+            for( int i = 0; i < i_cand; i++ )
+            {
+                SET_WEIGHT( weights[plane], 1, minscale, mindenom, cand[i] );
+                unsigned int s = x264_weight_cost_luma( h, fenc, mcbuf, &weights[plane] );
+                COPY3_IF_LT( minscore, s, minoff, cand[i], found, 1 );
+            }
         }
         x264_emms();
 
@@ -356,9 +385,21 @@ void x264_weights_analyse( x264_t *h, x264_frame_t *fenc, x264_frame_t *ref, int
     }
 }
 
+/* Whole-frame sums of a frame cost.  Each thread doing rows of the frame keeps
+ * its own, so that only per-mb and per-row data is written concurrently. */
+typedef struct
+{
+    int i_cost_est;
+    int i_cost_est_aq;
+    int i_intra_cost_est;
+    int i_intra_cost_est_aq;
+    int i_intra_mbs;
+} x264_lowres_cost_sum_t;
+
 static void x264_slicetype_mb_cost( x264_t *h, x264_mb_analysis_t *a,
                                     x264_frame_t **frames, int p0, int p1, int b,
-                                    int dist_scale_factor, int do_search[2], const x264_weight_t *w )
+                                    int dist_scale_factor, int do_search[2], const x264_weight_t *w,
+                                    x264_lowres_cost_sum_t *sum )
 {
     x264_frame_t *fref0 = frames[p0];
     x264_frame_t *fref1 = frames[p1];
@@ -493,7 +534,7 @@ static void x264_slicetype_mb_cost( x264_t *h, x264_mb_analysis_t *a,
         {
             int i_mvc = 0;
             int16_t (*fenc_mv)[2] = fenc_mvs[l];
-            ALIGNED_4( int16_t mvc[4][2] );
+            ALIGNED_4( int16_t mvc[5][2] );
 
             /* Reverse-order MV prediction. */
             M32( mvc[0] ) = 0;
@@ -509,11 +550,14 @@ static void x264_slicetype_mb_cost( x264_t *h, x264_mb_analysis_t *a,
                 if( i_mb_x < h->mb.i_mb_width - 1 )
                     MVC( fenc_mv[i_mb_stride+1] );
             }
-#undef MVC
             if( i_mvc <= 1 )
                 CP32( m[l].mvp, mvc[0] );
             else
                 x264_median_mv( m[l].mvp, mvc[0], mvc[1], mvc[2] );
+            /* The pyramid search left its estimate for this mb in place. */
+            if( h->param.rc.i_lookahead_pyramid )
+                MVC( fenc_mv[0] );
+#undef MVC
 
             /* Fast skip for cases of near-zero residual.  Shortcut: don't bother except in the mv0 case,
              * since anything else is likely to have enough residual to not trigger the skip. */
@@ -586,8 +630,8 @@ lowres_intra_mb:
             int i_icost_aq = i_icost;
             if( h->param.rc.i_aq_mode )
                 i_icost_aq = (i_icost_aq * frames[b]->i_inv_qscale_factor[i_mb_xy] + 128) >> 8;
-            fenc->i_cost_est[0][0] += i_icost;
-            fenc->i_cost_est_aq[0][0] += i_icost_aq;
+            sum->i_intra_cost_est += i_icost;
+            sum->i_intra_cost_est_aq += i_icost_aq;
             row_satd_intra[h->mb.i_mb_y] += i_icost_aq;
         }
     }
@@ -604,7 +648,7 @@ lowres_intra_mb:
             list_used = 0;
         }
         if( b_frame_score_mb )
-            fenc->i_intra_mbs[b-p0] += b_intra;
+            sum->i_intra_mbs += b_intra;
     }
 
     /* In an I-frame, we've already added the results above in the intra section. */
@@ -617,8 +661,8 @@ lowres_intra_mb:
         if( b_frame_score_mb )
         {
             /* Don't use AQ-weighted costs for slicetype decision, only for ratecontrol. */
-            frames[b]->i_cost_est[b-p0][p1-b] += i_bcost;
-            frames[b]->i_cost_est_aq[b-p0][p1-b] += i_bcost_aq;
+            sum->i_cost_est += i_bcost;
+            sum->i_cost_est_aq += i_bcost_aq;
         }
     }
 
@@ -626,6 +670,323 @@ lowres_intra_mb:
 }
 #undef TRY_BIDIR
 
+/* A frame cost, split by mb rows.  Rows are handed out bottom-up and each is
+ * done right to left, as in the serial loop.  An mb's motion vector predictors
+ * come from its right neighbour and from the three mbs below it, so a row only
+ * has to stay two mbs behind the row below for every mb to see exactly what it
+ * would in the serial loop: the result doesn't depend on the number of threads. */
+typedef struct
+{
+    x264_frame_t **frames;
+    int p0, p1, b;
+    int dist_scale_factor;
+    int *do_search;
+    const x264_weight_t *w;
+    int b_edges;
+    int i_mb_x0, i_mb_x1, i_mb_y0, i_mb_y1; /* inclusive */
+    int i_next_row;
+    x264_lowres_threads_t *threads; /* NULL when this thread does all the rows */
+} x264_lowres_cost_job_t;
+
+/* The mb-tree propagation of one frame into its references.  Saturating adds
+ * commute, so rows can be propagated in any order and into separate buffers. */
+typedef struct
+{
+    x264_frame_t *fenc;
+    uint16_t *lowres_costs;
+    int16_t (*mvs[2])[2];
+    int bipred_weights[2];
+    int i_lists; /* 1 for a P-frame, 2 for a B-frame */
+    int referenced;
+    float fps_factor;
+} x264_propagate_job_t;
+
+typedef struct
+{
+    x264_t *h;
+    x264_lowres_cost_job_t *job;
+    x264_lowres_cost_sum_t sum;
+    x264_propagate_job_t *prop;
+    int i_mb_y0, i_mb_y1;
+    uint16_t *ref_costs[2]; /* this thread's share of the propagated costs */
+    int *propagate_buf;
+} x264_lowres_worker_t;
+
+struct x264_lowres_threads_t
+{
+    int                  i_threads;
+    x264_threadpool_t    *pool;
+    /* [0] is the calling thread, which uses its own context */
+    x264_t               *thread[X264_LOOKAHEAD_THREAD_MAX];
+    x264_lowres_worker_t worker[X264_LOOKAHEAD_THREAD_MAX];
+    x264_pthread_mutex_t mutex;
+    x264_pthread_cond_t  cv_row;
+    int                  *row_done; /* mbs finished in each row of the current job */
+};
+
+static void x264_slicetype_rows_cost( x264_t *h, x264_mb_analysis_t *a, x264_lowres_cost_job_t *job, x264_lowres_cost_sum_t *sum )
+{
+    x264_lowres_threads_t *lt = job->threads;
+    x264_frame_t **frames = job->frames;
+    int p0 = job->p0, p1 = job->p1, b = job->b;
+    int *row_satd = frames[b]->i_row_satds[b-p0][p1-b];
+    int *row_satd_intra = frames[b]->i_row_satds[0][0];
+    int width = job->i_mb_x1 - job->i_mb_x0 + 1;
+
+    while( 1 )
+    {
+        int y;
+        if( lt )
+        {
+            x264_pthread_mutex_lock( &lt->mutex );
+            y = job->i_next_row--;
+            x264_pthread_mutex_unlock( &lt->mutex );
+        }
+        else
+            y = job->i_next_row--;
+        if( y < job->i_mb_y0 )
+            break;
+
+        h->mb.i_mb_y = y;
+        if( job->b_edges )
+        {
+            row_satd[y] = 0;
+            if( !frames[b]->b_intra_calculated )
+                row_satd_intra[y] = 0;
+        }
+        int below = y < job->i_mb_y1 ? 0 : width;
+        for( h->mb.i_mb_x = job->i_mb_x1; h->mb.i_mb_x >= job->i_mb_x0; h->mb.i_mb_x-- )
+        {
+            if( lt )
+            {
+                int need = X264_MIN( job->i_mb_x1 - h->mb.i_mb_x + 2, width );
+                if( below < need )
+                {
+                    x264_pthread_mutex_lock( &lt->mutex );
+                    while( (below = lt->row_done[y+1]) < need )
+                        x264_pthread_cond_wait( &lt->cv_row, &lt->mutex );
+                    x264_pthread_mutex_unlock( &lt->mutex );
+                }
+            }
+            x264_slicetype_mb_cost( h, a, frames, p0, p1, b, job->dist_scale_factor, job->do_search, job->w, sum );
+            if( lt )
+            {
+                x264_pthread_mutex_lock( &lt->mutex );
+                lt->row_done[y] = job->i_mb_x1 - h->mb.i_mb_x + 1;
+                x264_pthread_mutex_unlock( &lt->mutex );
+                x264_pthread_cond_broadcast( &lt->cv_row );
+            }
+        }
+    }
+}
+
+#if HAVE_THREAD
+static void *x264_slicetype_rows_thread( x264_lowres_worker_t *t )
+{
+    x264_mb_analysis_t a;
+    x264_lowres_context_init( t->h, &a );
+    x264_stack_align( x264_slicetype_rows_cost, t->h, &a, t->job, &t->sum );
+    x264_emms();
+    return NULL;
+}
+
+static void x264_slicetype_thread_init( x264_t *h )
+{
+#if HAVE_MMX
+    /* Misalign mask has to be set separately for each thread. */
+    if( h->param.cpu&X264_CPU_SSE_MISALIGN )
+        x264_cpu_mask_misalign_sse();
+#endif
+}
+#endif
+
+static x264_lowres_threads_t *x264_lowres_threads_get( x264_t *h )
+{
+    x264_lowres_threads_t *lt = h->lookahead ? h->lookahead->lowres_threads : NULL;
+    /* With a lookahead thread, the encoder threads may still get here through
+     * x264_weights_analyse; only the lookahead thread owns the helpers. */
+    if( lt && h->param.i_sync_lookahead && h != h->thread[h->param.i_threads] )
+        return NULL;
+    return lt;
+}
+
+static void x264_slicetype_rows_cost_threaded( x264_t *h, x264_mb_analysis_t *a, x264_lowres_cost_job_t *job, x264_lowres_cost_sum_t *sum )
+{
+    x264_lowres_threads_t *lt = x264_lowres_threads_get( h );
+    if( !lt || job->i_mb_y1 - job->i_mb_y0 < 2 )
+    {
+        job->threads = NULL;
+        x264_slicetype_rows_cost( h, a, job, sum );
+        return;
+    }
+#if HAVE_THREAD
+    job->threads = lt;
+    memset( lt->row_done, 0, h->mb.i_mb_height * sizeof(int) );
+    for( int i = 1; i < lt->i_threads; i++ )
+    {
+        x264_lowres_worker_t *t = &lt->worker[i];
+        /* reconfig may have changed the analysis settings */
+        t->h->param = h->param;
+        t->job = job;
+        memset( &t->sum, 0, sizeof(t->sum) );
+        x264_threadpool_run( lt->pool, (void*)x264_slicetype_rows_thread, t );
+    }
+    x264_slicetype_rows_cost( h, a, job, sum );
+    for( int i = 1; i < lt->i_threads; i++ )
+    {
+        x264_lowres_worker_t *t = &lt->worker[i];
+        x264_threadpool_wait( lt->pool, t );
+        sum->i_cost_est          += t->sum.i_cost_est;
+        sum->i_cost_est_aq       += t->sum.i_cost_est_aq;
+        sum->i_intra_cost_est    += t->sum.i_intra_cost_est;
+        sum->i_intra_cost_est_aq += t->sum.i_intra_cost_est_aq;
+        sum->i_intra_mbs         += t->sum.i_intra_mbs;
+    }
+#endif
+}
+
+int x264_slicetype_threads_init( x264_t *h )
+{
+#if HAVE_THREAD
+    if( h->param.i_lookahead_threads <= 1 )
+        return 0;
+
+    x264_lowres_threads_t *lt;
+    CHECKED_MALLOCZERO( lt, sizeof(x264_lowres_threads_t) );
+    h->lookahead->lowres_threads = lt;
+    lt->i_threads = h->param.i_lookahead_threads;
+    CHECKED_MALLOC( lt->row_done, h->mb.i_mb_height * sizeof(int) );
+    if( x264_pthread_mutex_init( &lt->mutex, NULL ) ||
+        x264_pthread_cond_init( &lt->cv_row, NULL ) )
+        goto fail;
+    for( int i = 1; i < lt->i_threads; i++ )
+    {
+        /* only the per-mb state in x264_t is used, so a plain copy will do */
+        CHECKED_MALLOC( lt->thread[i], sizeof(x264_t) );
+        *lt->thread[i] = *h;
+        lt->worker[i].h = lt->thread[i];
+        if( h->param.rc.b_mb_tree )
+        {
+            /* +3 for the simd overreads */
+            for( int j = 0; j < 2; j++ )
+                CHECKED_MALLOC( lt->worker[i].ref_costs[j], (h->mb.i_mb_count+3) * sizeof(uint16_t) );
+            CHECKED_MALLOC( lt->worker[i].propagate_buf, ((h->mb.i_mb_width+3)&~3) * sizeof(int) );
+        }
+    }
+    if( x264_threadpool_init( &lt->pool, lt->i_threads - 1, (void*)x264_slicetype_thread_init, h ) )
+        goto fail;
+    return 0;
+fail:
+    return -1;
+#else
+    return 0;
+#endif
+}
+
+void x264_slicetype_threads_delete( x264_t *h )
+{
+    x264_lowres_threads_t *lt = h->lookahead->lowres_threads;
+    if( !lt )
+        return;
+    if( lt->pool )
+        x264_threadpool_delete( lt->pool );
+    for( int i = 1; i < lt->i_threads; i++ )
+    {
+        x264_free( lt->thread[i] );
+        x264_free( lt->worker[i].ref_costs[0] );
+        x264_free( lt->worker[i].ref_costs[1] );
+        x264_free( lt->worker[i].propagate_buf );
+    }
+    x264_pthread_mutex_destroy( &lt->mutex );
+    x264_pthread_cond_destroy( &lt->cv_row );
+    x264_free( lt->row_done );
+    x264_free( lt );
+    h->lookahead->lowres_threads = NULL;
+}
+
+/* Coarse-to-fine motion search over the lookahead pyramid.  Each level searches
+ * 8x8 blocks around twice the result of the level above, so one block of
+ * level n covers 2^n x 2^n lowres mbs.  The quarter-size results are stored
+ * into the lowres mvs as the starting point of the lowres search.  The frame
+ * costs behind scenecut, b-adapt and mbtree are still measured at half size,
+ * so this speeds up the search for large motion but doesn't bound the cost. */
+static void x264_slicetype_pyramid_search( x264_t *h, x264_mb_analysis_t *a, x264_frame_t *fenc, x264_frame_t *fref,
+                                           int16_t (*lowres_mvs)[2], x264_lowres_cost_job_t *job )
+{
+    int levels = h->param.rc.i_lookahead_pyramid;
+    for( int l = levels; l > 0; l-- )
+    {
+        int width = (h->mb.i_mb_width + (1<<l) - 1) >> l;
+        int height = (h->mb.i_mb_height + (1<<l) - 1) >> l;
+        int up_width = (h->mb.i_mb_width + (2<<l) - 1) >> (l+1);
+        int stride = fenc->i_stride_pyramid[l-1];
+        int16_t (*mvs)[2] = h->lookahead->pyramid_mvs[l-1];
+        int16_t (*up)[2] = l < levels ? h->lookahead->pyramid_mvs[l] : NULL;
+        /* the largest motion is found at the top, the rest only refines */
+        int i_iter = l == levels ? 16 : 2;
+
+        for( int by = 0; by < height; by++ )
+            for( int bx = 0; bx < width; bx++ )
+            {
+                pixel *src = fenc->lowres_pyramid[l-1] + 8*(bx + by*stride);
+                pixel *ref = fref->lowres_pyramid[l-1] + 8*(bx + by*stride);
+                /* stay within the padding */
+                int mv_x_min = -8*bx - 16;
+                int mv_y_min = -8*by - 16;
+                int mv_x_max = fenc->i_width_pyramid[l-1] - 8*bx + 8;
+                int mv_y_max = fenc->i_lines_pyramid[l-1] - 8*by + 8;
+                int pmx = 0, pmy = 0;
+                if( up )
+                {
+                    pmx = 2 * up[(bx>>1) + (by>>1)*up_width][0];
+                    pmy = 2 * up[(bx>>1) + (by>>1)*up_width][1];
+                }
+                int bmx = 0, bmy = 0, bcost = COST_MAX;
+#define COST_PYRAMID_MV( mx, my )\
+                {\
+                    int x = x264_clip3( mx, mv_x_min, mv_x_max );\
+                    int y = x264_clip3( my, mv_y_min, mv_y_max );\
+                    int cost = h->pixf.sad[PIXEL_8x8]( src, stride, ref + x + y*stride, stride )\
+                             + a->p_cost_mv[4*(x-pmx)] + a->p_cost_mv[4*(y-pmy)];\
+                    COPY3_IF_LT( bcost, cost, bmx, x, bmy, y );\
+                }
+                COST_PYRAMID_MV( pmx, pmy );
+                COST_PYRAMID_MV( 0, 0 );
+                if( bx > 0 )
+                    COST_PYRAMID_MV( mvs[bx-1 + by*width][0], mvs[bx-1 + by*width][1] );
+                if( by > 0 )
+                {
+                    COST_PYRAMID_MV( mvs[bx + (by-1)*width][0], mvs[bx + (by-1)*width][1] );
+                    if( bx < width-1 )
+                        COST_PYRAMID_MV( mvs[bx+1 + (by-1)*width][0], mvs[bx+1 + (by-1)*width][1] );
+                }
+                for( int i = 0; i < i_iter; i++ )
+                {
+                    int omx = bmx, omy = bmy;
+                    COST_PYRAMID_MV( omx-1, omy );
+                    COST_PYRAMID_MV( omx+1, omy );
+                    COST_PYRAMID_MV( omx, omy-1 );
+                    COST_PYRAMID_MV( omx, omy+1 );
+                    if( bmx == omx && bmy == omy )
+                        break;
+                }
+#undef COST_PYRAMID_MV
+                mvs[bx + by*width][0] = bmx;
+                mvs[bx + by*width][1] = bmy;
+            }
+    }
+
+    /* quarter-size fullpel to lowres qpel */
+    int16_t (*mvs)[2] = h->lookahead->pyramid_mvs[0];
+    int width = (h->mb.i_mb_width + 1) >> 1;
+    for( int y = job->i_mb_y0; y <= job->i_mb_y1; y++ )
+        for( int x = job->i_mb_x0; x <= job->i_mb_x1; x++ )
+        {
+            lowres_mvs[x + y*h->mb.i_mb_width][0] = mvs[(x>>1) + (y>>1)*width][0] * 8;
+            lowres_mvs[x + y*h->mb.i_mb_width][1] = mvs[(x>>1) + (y>>1)*width][1] * 8;
+        }
+}
+
 #define NUM_MBS\
    (h->mb.i_mb_width > 2 && h->mb.i_mb_height > 2 ?\
    (h->mb.i_mb_width - 2) * (h->mb.i_mb_height - 2) :\
@@ -647,8 +1008,6 @@ static int x264_slicetype_frame_cost( x264_t *h, x264_mb_analysis_t *a,
     else
     {
         int dist_scale_factor = 128;
-        int *row_satd = frames[b]->i_row_satds[b-p0][p1-b];
-        int *row_satd_intra = frames[b]->i_row_satds[0][0];
 
         /* For each list, check to see whether we have lowres motion-searched this reference frame before. */
         do_search[0] = b != p0 && frames[b]->lowres_mvs[0][b-p0-1][0][0] == 0x7FFF;
@@ -683,23 +1042,40 @@ static int x264_slicetype_frame_cost( x264_t *h, x264_mb_analysis_t *a,
 
         /* The edge mbs seem to reduce the predictive quality of the
          * whole frame's score, but are needed for a spatial distribution. */
-        if( h->param.rc.b_mb_tree || h->param.rc.i_vbv_buffer_size ||
-            h->mb.i_mb_width <= 2 || h->mb.i_mb_height <= 2 )
+        x264_lowres_cost_job_t job;
+        job.frames = frames;
+        job.p0 = p0;
+        job.p1 = p1;
+        job.b = b;
+        job.dist_scale_factor = dist_scale_factor;
+        job.do_search = do_search;
+        job.w = w;
+        job.b_edges = h->param.rc.b_mb_tree || h->param.rc.i_vbv_buffer_size ||
+                      h->mb.i_mb_width <= 2 || h->mb.i_mb_height <= 2;
+        job.i_mb_x0 = !job.b_edges;
+        job.i_mb_x1 = h->mb.i_mb_width - 1 - !job.b_edges;
+        job.i_mb_y0 = !job.b_edges;
+        job.i_mb_y1 = h->mb.i_mb_height - 1 - !job.b_edges;
+        job.i_next_row = job.i_mb_y1;
+
+        if( h->param.rc.i_lookahead_pyramid )
         {
-            for( h->mb.i_mb_y = h->mb.i_mb_height - 1; h->mb.i_mb_y >= 0; h->mb.i_mb_y-- )
-            {
-                row_satd[h->mb.i_mb_y] = 0;
-                if( !frames[b]->b_intra_calculated )
-                    row_satd_intra[h->mb.i_mb_y] = 0;
-                for( h->mb.i_mb_x = h->mb.i_mb_width - 1; h->mb.i_mb_x >= 0; h->mb.i_mb_x-- )
-                    x264_slicetype_mb_cost( h, a, frames, p0, p1, b, dist_scale_factor, do_search, w );
-            }
+            if( do_search[0] )
+                x264_slicetype_pyramid_search( h, a, frames[b], frames[p0], frames[b]->lowres_mvs[0][b-p0-1], &job );
+            if( do_search[1] )
+                x264_slicetype_pyramid_search( h, a, frames[b], frames[p1], frames[b]->lowres_mvs[1][p1-b-1], &job );
         }
-        else
+
+        x264_lowres_cost_sum_t sum = {0};
+        x264_slicetype_rows_cost_threaded( h, a, &job, &sum );
+
+        frames[b]->i_cost_est[b-p0][p1-b] += sum.i_cost_est;
+        frames[b]->i_cost_est_aq[b-p0][p1-b] += sum.i_cost_est_aq;
+        frames[b]->i_intra_mbs[b-p0] += sum.i_intra_mbs;
+        if( !frames[b]->b_intra_calculated )
         {
-            for( h->mb.i_mb_y = h->mb.i_mb_height - 2; h->mb.i_mb_y >= 1; h->mb.i_mb_y-- )
-                for( h->mb.i_mb_x = h->mb.i_mb_width - 2; h->mb.i_mb_x >= 1; h->mb.i_mb_x-- )
-                    x264_slicetype_mb_cost( h, a, frames, p0, p1, b, dist_scale_factor, do_search, w );
+            frames[b]->i_cost_est[0][0] += sum.i_intra_cost_est;
+            frames[b]->i_cost_est_aq[0][0] += sum.i_intra_cost_est_aq;
         }
 
         i_score = frames[b]->i_cost_est[b-p0][p1-b];
@@ -772,94 +1148,114 @@ static void x264_macroblock_tree_finish( x264_t *h, x264_frame_t *frame, float a
     }
 }
 
+static void x264_macroblock_tree_propagate_rows( x264_t *h, x264_propagate_job_t *job, uint16_t *ref_costs[2],
+                                                 int *buf, int y0, int y1 )
+{
+    x264_frame_t *fenc = job->fenc;
+    for( int y = y0; y < y1; y++ )
+    {
+        int mb_index = y*h->mb.i_mb_stride;
+        uint16_t *propagate_cost = fenc->i_propagate_cost + (job->referenced ? y*h->mb.i_mb_width : 0);
+        h->mc.mbtree_propagate_cost( buf, propagate_cost,
+            fenc->i_intra_cost+mb_index, job->lowres_costs+mb_index,
+            fenc->i_inv_qscale_factor+mb_index, &job->fps_factor, h->mb.i_mb_width );
+        /* Follow the MVs to the previous frame(s). */
+        for( int list = 0; list < job->i_lists; list++ )
+            h->mc.mbtree_propagate_list( h, ref_costs[list], job->mvs[list]+mb_index, buf,
+                                         job->lowres_costs+mb_index, job->bipred_weights[list],
+                                         y, h->mb.i_mb_width, list );
+    }
+}
+
+#if HAVE_THREAD
+static void *x264_macroblock_tree_propagate_thread( x264_lowres_worker_t *t )
+{
+    x264_stack_align( x264_macroblock_tree_propagate_rows, t->h, t->prop, t->ref_costs,
+                      t->propagate_buf, t->i_mb_y0, t->i_mb_y1 );
+    x264_emms();
+    return NULL;
+}
+#endif
+
 static void x264_macroblock_tree_propagate( x264_t *h, x264_frame_t **frames, float average_duration, int p0, int p1, int b, int referenced )
 {
     uint16_t *ref_costs[2] = {frames[p0]->i_propagate_cost,frames[p1]->i_propagate_cost};
     int dist_scale_factor = ( ((b-p0) << 8) + ((p1-p0) >> 1) ) / (p1-p0);
     int i_bipred_weight = h->param.analyse.b_weighted_bipred ? 64 - (dist_scale_factor>>2) : 32;
-    int16_t (*mvs[2])[2] = { frames[b]->lowres_mvs[0][b-p0-1], frames[b]->lowres_mvs[1][p1-b-1] };
-    int bipred_weights[2] = {i_bipred_weight, 64 - i_bipred_weight};
-    int *buf = h->scratch_buffer;
-    uint16_t *propagate_cost = frames[b]->i_propagate_cost;
+    x264_propagate_job_t job;
+    job.fenc = frames[b];
+    job.lowres_costs = frames[b]->lowres_costs[b-p0][p1-b];
+    job.mvs[0] = frames[b]->lowres_mvs[0][b-p0-1];
+    job.mvs[1] = b != p1 ? frames[b]->lowres_mvs[1][p1-b-1] : NULL;
+    job.bipred_weights[0] = i_bipred_weight;
+    job.bipred_weights[1] = 64 - i_bipred_weight;
+    job.i_lists = 1 + (b != p1);
+    job.referenced = referenced;
 
     x264_emms();
-    float fps_factor = CLIP_DURATION(frames[b]->f_duration) / CLIP_DURATION(average_duration);
+    job.fps_factor = CLIP_DURATION(frames[b]->f_duration) / CLIP_DURATION(average_duration);
+
+    /* A non-referenced frame's amounts don't depend on the rest of the tree, so
+     * if they were already propagated with the same references, only add them. */
+    x264_frame_t *fenc = frames[b];
+    int b_cached = !referenced && fenc->i_propagate_out[0];
+    if( b_cached && fenc->i_propagate_out_dist[0] == b-p0 && fenc->i_propagate_out_dist[1] == p1-b &&
+        fenc->f_propagate_out_fps == job.fps_factor )
+    {
+        for( int list = 0; list < job.i_lists; list++ )
+            for( int j = 0; j < h->mb.i_mb_count; j++ )
+                MBTREE_CLIP_ADD( ref_costs[list][j], fenc->i_propagate_out[list][j] );
+        return;
+    }
+    uint16_t **dst = ref_costs;
+    if( b_cached )
+    {
+        for( int list = 0; list < job.i_lists; list++ )
+            memset( fenc->i_propagate_out[list], 0, h->mb.i_mb_count * sizeof(uint16_t) );
+        dst = fenc->i_propagate_out;
+    }
 
     /* For non-reffed frames the source costs are always zero, so just memset one row and re-use it. */
     if( !referenced )
         memset( frames[b]->i_propagate_cost, 0, h->mb.i_mb_width * sizeof(uint16_t) );
 
-    for( h->mb.i_mb_y = 0; h->mb.i_mb_y < h->mb.i_mb_height; h->mb.i_mb_y++ )
+    x264_lowres_threads_t *lt = x264_lowres_threads_get( h );
+    if( !lt || h->mb.i_mb_height < lt->i_threads )
+        x264_macroblock_tree_propagate_rows( h, &job, dst, h->scratch_buffer, 0, h->mb.i_mb_height );
+#if HAVE_THREAD
+    else
     {
-        int mb_index = h->mb.i_mb_y*h->mb.i_mb_stride;
-        h->mc.mbtree_propagate_cost( buf, propagate_cost,
-            frames[b]->i_intra_cost+mb_index, frames[b]->lowres_costs[b-p0][p1-b]+mb_index,
-            frames[b]->i_inv_qscale_factor+mb_index, &fps_factor, h->mb.i_mb_width );
-        if( referenced )
-            propagate_cost += h->mb.i_mb_width;
-        for( h->mb.i_mb_x = 0; h->mb.i_mb_x < h->mb.i_mb_width; h->mb.i_mb_x++, mb_index++ )
+        int n = lt->i_threads;
+        for( int i = 1; i < n; i++ )
         {
-            int propagate_amount = buf[h->mb.i_mb_x];
-            /* Don't propagate for an intra block. */
-            if( propagate_amount > 0 )
-            {
-                /* Access width-2 bitfield. */
-                int lists_used = frames[b]->lowres_costs[b-p0][p1-b][mb_index] >> LOWRES_COST_SHIFT;
-                /* Follow the MVs to the previous frame(s). */
-                for( int list = 0; list < 2; list++ )
-                    if( (lists_used >> list)&1 )
-                    {
-#define CLIP_ADD(s,x) (s) = X264_MIN((s)+(x),(1<<16)-1)
-                        int listamount = propagate_amount;
-                        /* Apply bipred weighting. */
-                        if( lists_used == 3 )
-                            listamount = (listamount * bipred_weights[list] + 32) >> 6;
-
-                        /* Early termination for simple case of mv0. */
-                        if( !M32( mvs[list][mb_index] ) )
-                        {
-                            CLIP_ADD( ref_costs[list][mb_index], listamount );
-                            continue;
-                        }
-
-                        int x = mvs[list][mb_index][0];
-                        int y = mvs[list][mb_index][1];
-                        int mbx = (x>>5)+h->mb.i_mb_x;
-                        int mby = (y>>5)+h->mb.i_mb_y;
-                        int idx0 = mbx + mby * h->mb.i_mb_stride;
-                        int idx1 = idx0 + 1;
-                        int idx2 = idx0 + h->mb.i_mb_stride;
-                        int idx3 = idx0 + h->mb.i_mb_stride + 1;
-                        x &= 31;
-                        y &= 31;
-                        int idx0weight = (32-y)*(32-x);
-                        int idx1weight = (32-y)*x;
-                        int idx2weight = y*(32-x);
-                        int idx3weight = y*x;
-
-                        /* We could just clip the MVs, but pixels that lie outside the frame probably shouldn't
-                         * be counted. */
-                        if( mbx < h->mb.i_mb_width-1 && mby < h->mb.i_mb_height-1 && mbx >= 0 && mby >= 0 )
-                        {
-                            CLIP_ADD( ref_costs[list][idx0], (listamount*idx0weight+512)>>10 );
-                            CLIP_ADD( ref_costs[list][idx1], (listamount*idx1weight+512)>>10 );
-                            CLIP_ADD( ref_costs[list][idx2], (listamount*idx2weight+512)>>10 );
-                            CLIP_ADD( ref_costs[list][idx3], (listamount*idx3weight+512)>>10 );
-                        }
-                        else /* Check offsets individually */
-                        {
-                            if( mbx < h->mb.i_mb_width && mby < h->mb.i_mb_height && mbx >= 0 && mby >= 0 )
-                                CLIP_ADD( ref_costs[list][idx0], (listamount*idx0weight+512)>>10 );
-                            if( mbx+1 < h->mb.i_mb_width && mby < h->mb.i_mb_height && mbx+1 >= 0 && mby >= 0 )
-                                CLIP_ADD( ref_costs[list][idx1], (listamount*idx1weight+512)>>10 );
-                            if( mbx < h->mb.i_mb_width && mby+1 < h->mb.i_mb_height && mbx >= 0 && mby+1 >= 0 )
-                                CLIP_ADD( ref_costs[list][idx2], (listamount*idx2weight+512)>>10 );
-                            if( mbx+1 < h->mb.i_mb_width && mby+1 < h->mb.i_mb_height && mbx+1 >= 0 && mby+1 >= 0 )
-                                CLIP_ADD( ref_costs[list][idx3], (listamount*idx3weight+512)>>10 );
-                        }
-                    }
-            }
+            x264_lowres_worker_t *t = &lt->worker[i];
+            t->prop = &job;
+            t->i_mb_y0 = h->mb.i_mb_height * i / n;
+            t->i_mb_y1 = h->mb.i_mb_height * (i+1) / n;
+            for( int list = 0; list < job.i_lists; list++ )
+                memset( t->ref_costs[list], 0, h->mb.i_mb_count * sizeof(uint16_t) );
+            x264_threadpool_run( lt->pool, (void*)x264_macroblock_tree_propagate_thread, t );
         }
+        x264_macroblock_tree_propagate_rows( h, &job, dst, h->scratch_buffer, 0, h->mb.i_mb_height / n );
+        for( int i = 1; i < n; i++ )
+        {
+            x264_lowres_worker_t *t = &lt->worker[i];
+            x264_threadpool_wait( lt->pool, t );
+            for( int list = 0; list < job.i_lists; list++ )
+                for( int j = 0; j < h->mb.i_mb_count; j++ )
+                    MBTREE_CLIP_ADD( dst[list][j], t->ref_costs[list][j] );
+        }
+    }
+#endif
+
+    if( b_cached )
+    {
+        fenc->i_propagate_out_dist[0] = b-p0;
+        fenc->i_propagate_out_dist[1] = p1-b;
+        fenc->f_propagate_out_fps = job.fps_factor;
+        for( int list = 0; list < job.i_lists; list++ )
+            for( int j = 0; j < h->mb.i_mb_count; j++ )
+                MBTREE_CLIP_ADD( ref_costs[list][j], fenc->i_propagate_out[list][j] );
     }
 
     if( h->param.rc.i_vbv_buffer_size && h->param.rc.i_lookahead && referenced )
@@ -1646,7 +2042,6 @@ int x264_rc_analyse_slice( x264_t *h )
         cost = frames[b]->i_cost_est_aq[b-p0][p1-b];
 
     h->fenc->i_row_satd = h->fenc->i_row_satds[b-p0][p1-b];
-    h->fdec->i_row_satd = h->fdec->i_row_satds[b-p0][p1-b];
     h->fdec->i_satd = cost;
     memcpy( h->fdec->i_row_satd, h->fenc->i_row_satd, h->mb.i_mb_height * sizeof(int) );
     if( !IS_X264_TYPE_I(h->fenc->i_type) )
@@ -60,14 +60,14 @@ static int csp_num_interleaved( int csp, int plane )
  * written in such a way so that if the source has been upconverted using the
  * same algorithm as used in scale_image, dithering down to the source bit
  * depth again is lossless. */
-#define DITHER_PLANE( pitch ) \
-static void dither_plane_##pitch( pixel *dst, int dst_stride, uint16_t *src, int src_stride, \
-                                        int width, int height, int16_t *errors ) \
+#define DITHER_PLANE( pitch, type ) \
+static void dither_plane_##pitch##_##type( type *dst, int dst_stride, uint16_t *src, int src_stride, \
+                                           int width, int height, int16_t *errors, int bit_depth ) \
 { \
-    const int lshift = 16-BIT_DEPTH; \
-    const int rshift = 2*BIT_DEPTH-16; \
-    const int pixel_max = (1 << BIT_DEPTH)-1; \
-    const int half = 1 << (16-BIT_DEPTH); \
+    const int lshift = 16-bit_depth; \
+    const int rshift = 2*bit_depth-16; \
+    const int pixel_max = (1 << bit_depth)-1; \
+    const int half = 1 << (16-bit_depth); \
     memset( errors, 0, (width+1) * sizeof(int16_t) ); \
     for( int y = 0; y < height; y++, src += src_stride, dst += dst_stride ) \
     { \
@@ -81,10 +81,12 @@ static void dither_plane_##pitch( pixel *dst, int dst_stride, uint16_t *src, int
     } \
 }
 
-DITHER_PLANE( 1 )
-DITHER_PLANE( 2 )
+DITHER_PLANE( 1, uint8_t )
+DITHER_PLANE( 2, uint8_t )
+DITHER_PLANE( 1, uint16_t )
+DITHER_PLANE( 2, uint16_t )
 
-static void dither_image( cli_image_t *out, cli_image_t *img, int16_t *error_buf )
+static void dither_image( cli_image_t *out, cli_image_t *img, int16_t *error_buf, int bit_depth )
 {
     int csp_mask = img->csp & X264_CSP_MASK;
     for( int i = 0; i < img->planes; i++ )
@@ -93,23 +95,32 @@ static void dither_image( cli_image_t *out, cli_image_t *img, int16_t *error_buf
         int height = x264_cli_csps[csp_mask].height[i] * img->height;
         int width = x264_cli_csps[csp_mask].width[i] * img->width / num_interleaved;
 
-#define CALL_DITHER_PLANE( pitch, off ) \
-        dither_plane_##pitch( ((pixel*)out->plane[i])+off, out->stride[i]/sizeof(pixel), \
-                ((uint16_t*)img->plane[i])+off, img->stride[i]/2, width, height, error_buf )
+#define CALL_DITHER_PLANE( pitch, type, off ) \
+        dither_plane_##pitch##_##type( ((type*)out->plane[i])+off, out->stride[i]/sizeof(type), \
+                ((uint16_t*)img->plane[i])+off, img->stride[i]/2, width, height, error_buf, bit_depth )
 
-        if( num_interleaved == 1 )
+        if( bit_depth > 8 && num_interleaved == 1 )
         {
-            CALL_DITHER_PLANE( 1, 0 );
+            CALL_DITHER_PLANE( 1, uint16_t, 0 );
+        }
+        else if( bit_depth > 8 )
+        {
+            CALL_DITHER_PLANE( 2, uint16_t, 0 );
+            CALL_DITHER_PLANE( 2, uint16_t, 1 );
+        }
+        else if( num_interleaved == 1 )
+        {
+            CALL_DITHER_PLANE( 1, uint8_t, 0 );
         }
         else
         {
-            CALL_DITHER_PLANE( 2, 0 );
-            CALL_DITHER_PLANE( 2, 1 );
+            CALL_DITHER_PLANE( 2, uint8_t, 0 );
+            CALL_DITHER_PLANE( 2, uint8_t, 1 );
         }
     }
 }
 
-static void scale_image( cli_image_t *output, cli_image_t *img )
+static void scale_image( cli_image_t *output, cli_image_t *img, int bit_depth )
 {
     /* this function mimics how swscale does upconversion. 8-bit is converted
      * to 16-bit through left shifting the orginal value with 8 and then adding
@@ -117,7 +128,7 @@ static void scale_image( cli_image_t *output, cli_image_t *img )
      * while also being fast. for n-bit we basically do the same thing, but we
      * discard the lower 16-n bits. */
     int csp_mask = img->csp & X264_CSP_MASK;
-    const int shift = 16-BIT_DEPTH;
+    const int shift = 16-bit_depth;
     for( int i = 0; i < img->planes; i++ )
     {
         uint8_t *src = img->plane[i];
@@ -145,12 +156,12 @@ static int get_frame( hnd_t handle, cli_pic_t *output, int frame )
 
     if( h->bit_depth < 16 && output->img.csp & X264_CSP_HIGH_DEPTH )
     {
-        dither_image( &h->buffer.img, &output->img, h->error_buf );
+        dither_image( &h->buffer.img, &output->img, h->error_buf, h->bit_depth );
         output->img = h->buffer.img;
     }
     else if( h->bit_depth > 8 && !(output->img.csp & X264_CSP_HIGH_DEPTH) )
     {
-        scale_image( &h->buffer.img, &output->img );
+        scale_image( &h->buffer.img, &output->img, h->bit_depth );
         output->img = h->buffer.img;
     }
     return 0;
@@ -197,7 +208,7 @@ static int init( hnd_t *handle, cli_vid_filter_t *filter, video_info_t *info,
             ret = 1;
     }
 
-    FAIL_IF_ERROR( bit_depth != BIT_DEPTH, "this build supports only bit depth %d\n", BIT_DEPTH )
+    FAIL_IF_ERROR( bit_depth != param->i_bitdepth, "the output bit depth is %d\n", param->i_bitdepth )
     FAIL_IF_ERROR( ret, "unsupported bit depth conversion.\n" )
 
     /* only add the filter to the chain if it's needed */
@@ -0,0 +1,602 @@
+/*****************************************************************************
+ * fmp4.c: fragmented mp4 muxer
+ *****************************************************************************
+ * Copyright (C) 2003-2011 x264 project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ * This program is also available under a commercial proprietary license.
+ * For more information, contact us at licensing@x264.com.
+ *****************************************************************************/
+
+#include "output.h"
+
+/* Writes an init segment (ftyp+moov) followed by one moof+mdat fragment per GOP.
+ * The file is written strictly sequentially, so it can be played back, piped
+ * or served while it is still being encoded. */
+
+#define CHECK(x)\
+do {\
+    if( (x) < 0 )\
+        return -1;\
+} while( 0 )
+
+#define MAX_BOX_DEPTH 8
+
+#define TRACK_ID 1
+
+/* sample_flags from ISO/IEC 14496-12 8.8.3.1 */
+#define SAMPLE_DEPENDS_ON_OTHERS     0x01000000
+#define SAMPLE_DEPENDS_ON_NONE       0x02000000
+#define SAMPLE_NOT_DEPENDED_ON       0x00800000
+#define SAMPLE_IS_NON_SYNC           0x00010000
+
+typedef struct
+{
+    uint8_t *data;
+    unsigned d_cur;
+    unsigned d_max;
+    unsigned stack[MAX_BOX_DEPTH];
+    int i_depth;
+    int b_error;
+} box_buffer;
+
+typedef struct
+{
+    uint32_t i_size;
+    uint32_t i_flags;
+    int64_t i_dts;
+    int64_t i_cts;
+} fmp4_sample_t;
+
+typedef struct
+{
+    FILE *fp;
+
+    int width, height;
+    int sar_width, sar_height;
+    int i_bitdepth;
+    uint64_t i_time_res;
+    uint64_t i_time_inc;
+
+    uint8_t *avcC;
+    int avcC_len;
+    uint8_t *sei;
+    int sei_len;
+
+    int64_t i_delay_time;
+    int b_continuous;
+    int64_t i_first_pts;
+    int64_t i_first_dts;
+    int64_t i_numframe;
+    int64_t i_prev_duration;
+    uint32_t i_sequence;
+
+    box_buffer box;      /* moov or moof under construction */
+    box_buffer mdat;     /* sample data of the current fragment */
+    fmp4_sample_t *samples;
+    int i_samples;
+    int i_samples_max;
+} fmp4_hnd_t;
+
+static int box_reserve( box_buffer *b, unsigned size )
+{
+    unsigned ns = b->d_cur + size;
+    if( ns > b->d_max )
+    {
+        unsigned dn = b->d_max ? b->d_max << 1 : 4096;
+        while( ns > dn )
+            dn <<= 1;
+        uint8_t *dp = realloc( b->data, dn );
+        if( !dp )
+            return -1;
+        b->data = dp;
+        b->d_max = dn;
+    }
+    return 0;
+}
+
+static int box_append( box_buffer *b, const void *data, unsigned size )
+{
+    CHECK( box_reserve( b, size ) );
+    memcpy( b->data + b->d_cur, data, size );
+    b->d_cur += size;
+    return 0;
+}
+
+static void put_byte( box_buffer *b, uint8_t val )
+{
+    /* allocation failures are reported by box_end */
+    if( box_reserve( b, 1 ) )
+        b->b_error = 1;
+    else
+        b->data[b->d_cur++] = val;
+}
+
+static void put_be16( box_buffer *b, uint16_t val )
+{
+    put_byte( b, val >> 8 );
+    put_byte( b, val );
+}
+
+static void put_be32( box_buffer *b, uint32_t val )
+{
+    put_be16( b, val >> 16 );
+    put_be16( b, val );
+}
+
+static void put_be64( box_buffer *b, uint64_t val )
+{
+    put_be32( b, val >> 32 );
+    put_be32( b, val );
+}
+
+static void put_zero( box_buffer *b, int count )
+{
+    while( count-- )
+        put_byte( b, 0 );
+}
+
+static void put_tag( box_buffer *b, const char *tag )
+{
+    while( *tag )
+        put_byte( b, *tag++ );
+}
+
+static void put_matrix( box_buffer *b )
+{
+    put_be32( b, 0x00010000 ); put_be32( b, 0 ); put_be32( b, 0 );
+    put_be32( b, 0 ); put_be32( b, 0x00010000 ); put_be32( b, 0 );
+    put_be32( b, 0 ); put_be32( b, 0 ); put_be32( b, 0x40000000 );
+}
+
+static void box_start( box_buffer *b, const char *type )
+{
+    assert( b->i_depth < MAX_BOX_DEPTH );
+    b->stack[b->i_depth++] = b->d_cur;
+    put_be32( b, 0 ); // size, written in box_end
+    put_tag( b, type );
+}
+
+static void full_box_start( box_buffer *b, const char *type, int version, uint32_t flags )
+{
+    box_start( b, type );
+    put_be32( b, (version << 24) | flags );
+}
+
+static int box_end( box_buffer *b )
+{
+    unsigned start = b->stack[--b->i_depth];
+    unsigned size = b->d_cur - start;
+    if( b->b_error )
+        return -1;
+    b->data[start+0] = size >> 24;
+    b->data[start+1] = size >> 16;
+    b->data[start+2] = size >> 8;
+    b->data[start+3] = size;
+    return 0;
+}
+
+static int box_flush( fmp4_hnd_t *p_fmp4, box_buffer *b )
+{
+    if( b->b_error || fwrite( b->data, b->d_cur, 1, p_fmp4->fp ) != 1 )
+        return -1;
+    b->d_cur = 0;
+    return 0;
+}
+
+static int open_file( char *psz_filename, hnd_t *p_handle, cli_output_opt_t *opt )
+{
+    *p_handle = NULL;
+    fmp4_hnd_t *p_fmp4 = calloc( 1, sizeof(fmp4_hnd_t) );
+    if( !p_fmp4 )
+        return -1;
+
+    if( !strcmp( psz_filename, "-" ) )
+        p_fmp4->fp = stdout;
+    else
+        p_fmp4->fp = fopen( psz_filename, "wb" );
+    if( !p_fmp4->fp )
+    {
+        free( p_fmp4 );
+        return -1;
+    }
+    p_fmp4->b_continuous = opt->b_continuous;
+    p_fmp4->i_first_pts = opt->i_first_pts;
+    p_fmp4->i_first_dts = opt->i_first_dts;
+
+    *p_handle = p_fmp4;
+    return 0;
+}
+
+static int set_param( hnd_t handle, x264_param_t *p_param )
+{
+    fmp4_hnd_t *p_fmp4 = handle;
+
+    p_fmp4->width = p_param->i_width;
+    p_fmp4->height = p_param->i_height;
+    p_fmp4->sar_width = p_param->vui.i_sar_width;
+    p_fmp4->sar_height = p_param->vui.i_sar_height;
+    p_fmp4->i_bitdepth = p_param->i_bitdepth;
+
+    p_fmp4->i_time_res = p_param->i_timebase_den;
+    p_fmp4->i_time_inc = p_param->i_timebase_num;
+    FAIL_IF_ERR( p_fmp4->i_time_res > UINT32_MAX, "fmp4", "MP4 media timescale %"PRIu64" exceeds maximum\n", p_fmp4->i_time_res )
+
+    return 0;
+}
+
+static int write_headers( hnd_t handle, x264_nal_t *p_nal )
+{
+    fmp4_hnd_t *p_fmp4 = handle;
+
+    int sps_size = p_nal[0].i_payload - 4;
+    int pps_size = p_nal[1].i_payload - 4;
+    int sei_size = p_nal[2].i_payload;
+
+    uint8_t *sps = p_nal[0].p_payload + 4;
+    uint8_t *pps = p_nal[1].p_payload + 4;
+    uint8_t *sei = p_nal[2].p_payload;
+
+    /* the init segment needs the initial delay for its edit list,
+     * so it is written together with the first fragment */
+    box_buffer avcC = {0};
+    put_byte( &avcC, 1 );      // version
+    put_byte( &avcC, sps[1] ); // profile
+    put_byte( &avcC, sps[2] ); // profile compat
+    put_byte( &avcC, sps[3] ); // level
+    put_byte( &avcC, 0xff );   // 6 bits reserved (111111) + 2 bits nal size length - 1 (11)
+    put_byte( &avcC, 0xe1 );   // 3 bits reserved (111) + 5 bits number of sps (00001)
+    put_be16( &avcC, sps_size );
+    avcC.b_error |= box_append( &avcC, sps, sps_size );
+    put_byte( &avcC, 1 );      // number of pps
+    put_be16( &avcC, pps_size );
+    avcC.b_error |= box_append( &avcC, pps, pps_size );
+    if( sps[1] >= 100 )
+    {
+        put_byte( &avcC, 0xfc | 1 );                  // 6 bits reserved + chroma_format_idc (4:2:0)
+        put_byte( &avcC, 0xf8 | (p_fmp4->i_bitdepth-8) ); // 5 bits reserved + bit_depth_luma_minus8
+        put_byte( &avcC, 0xf8 | (p_fmp4->i_bitdepth-8) ); // 5 bits reserved + bit_depth_chroma_minus8
+        put_byte( &avcC, 0 );                         // number of sps ext
+    }
+    if( avcC.b_error )
+    {
+        free( avcC.data );
+        return -1;
+    }
+    p_fmp4->avcC = avcC.data;
+    p_fmp4->avcC_len = avcC.d_cur;
+
+    /* the sei is prepended to the first sample */
+    p_fmp4->sei = malloc( sei_size );
+    if( !p_fmp4->sei )
+        return -1;
+    memcpy( p_fmp4->sei, sei, sei_size );
+    p_fmp4->sei_len = sei_size;
+
+    return sei_size + sps_size + pps_size;
+}
+
+static int write_init_segment( fmp4_hnd_t *p_fmp4, int64_t i_media_time )
+{
+    box_buffer *b = &p_fmp4->box;
+
+    box_start( b, "ftyp" );
+    put_tag( b, "iso6" ); // major brand
+    put_be32( b, 0 );     // minor version
+    put_tag( b, "iso6" );
+    put_tag( b, "cmfc" );
+    put_tag( b, "avc1" );
+    put_tag( b, "mp41" );
+    CHECK( box_end( b ) );
+
+    box_start( b, "moov" );
+
+    full_box_start( b, "mvhd", 0, 0 );
+    put_be32( b, 0 );                   // creation time
+    put_be32( b, 0 );                   // modification time
+    put_be32( b, p_fmp4->i_time_res );  // timescale
+    put_be32( b, 0 );                   // duration, unknown for fragmented files
+    put_be32( b, 0x00010000 );          // rate
+    put_be16( b, 0x0100 );              // volume
+    put_zero( b, 10 );                  // reserved
+    put_matrix( b );
+    put_zero( b, 24 );                  // pre-defined
+    put_be32( b, TRACK_ID + 1 );        // next track id
+    CHECK( box_end( b ) );
+
+    box_start( b, "trak" );
+
+    int d_width = p_fmp4->width;
+    int d_height = p_fmp4->height;
+    if( p_fmp4->sar_width && p_fmp4->sar_height )
+        d_width = (int64_t)d_width * p_fmp4->sar_width / p_fmp4->sar_height;
+    full_box_start( b, "tkhd", 0, 3 ); // track enabled, in movie
+    put_be32( b, 0 );                   // creation time
+    put_be32( b, 0 );                   // modification time
+    put_be32( b, TRACK_ID );
+    put_be32( b, 0 );                   // reserved
+    put_be32( b, 0 );                   // duration
+    put_zero( b, 8 );                   // reserved
+    put_be16( b, 0 );                   // layer
+    put_be16( b, 0 );                   // alternate group
+    put_be16( b, 0 );                   // volume
+    put_be16( b, 0 );                   // reserved
+    put_matrix( b );
+    put_be32( b, d_width << 16 );
+    put_be32( b, d_height << 16 );
+    CHECK( box_end( b ) );
+
+    if( i_media_time )
+    {
+        /* skip the initial delay introduced by b-frames */
+        box_start( b, "edts" );
+        full_box_start( b, "elst", 0, 0 );
+        put_be32( b, 1 );               // entry count
+        put_be32( b, 0 );               // segment duration, unknown
+        put_be32( b, i_media_time );
+        put_be32( b, 0x00010000 );      // media rate
+        CHECK( box_end( b ) );
+        CHECK( box_end( b ) );
+    }
+
+    box_start( b, "mdia" );
+
+    full_box_start( b, "mdhd", 0, 0 );
+    put_be32( b, 0 );                   // creation time
+    put_be32( b, 0 );                   // modification time
+    put_be32( b, p_fmp4->i_time_res );  // timescale
+    put_be32( b, 0 );                   // duration
+    put_be16( b, 0x55c4 );              // language "und"
+    put_be16( b, 0 );                   // pre-defined
+    CHECK( box_end( b ) );
+
+    full_box_start( b, "hdlr", 0, 0 );
+    put_be32( b, 0 );                   // pre-defined
+    put_tag( b, "vide" );
+    put_zero( b, 12 );                  // reserved
+    put_tag( b, "VideoHandler" );
+    put_byte( b, 0 );
+    CHECK( box_end( b ) );
+
+    box_start( b, "minf" );
+
+    full_box_start( b, "vmhd", 0, 1 );
+    put_zero( b, 8 );                   // graphics mode, opcolor
+    CHECK( box_end( b ) );
+
+    box_start( b, "dinf" );
+    full_box_start( b, "dref", 0, 0 );
+    put_be32( b, 1 );                   // entry count
+    full_box_start( b, "url ", 0, 1 );  // media data is in this file
+    CHECK( box_end( b ) );
+    CHECK( box_end( b ) );
+    CHECK( box_end( b ) );
+
+    box_start( b, "stbl" );
+
+    full_box_start( b, "stsd", 0, 0 );
+    put_be32( b, 1 );                   // entry count
+    box_start( b, "avc1" );
+    put_zero( b, 6 );                   // reserved
+    put_be16( b, 1 );                   // data reference index
+    put_zero( b, 16 );                  // pre-defined, reserved
+    put_be16( b, p_fmp4->width );
+    put_be16( b, p_fmp4->height );
+    put_be32( b, 0x00480000 );          // 72 dpi
+    put_be32( b, 0x00480000 );
+    put_be32( b, 0 );                   // reserved
+    put_be16( b, 1 );                   // frame count
+    put_zero( b, 32 );                  // compressor name
+    put_be16( b, 0x0018 );              // depth
+    put_be16( b, 0xffff );              // pre-defined
+    box_start( b, "avcC" );
+    b->b_error |= box_append( b, p_fmp4->avcC, p_fmp4->avcC_len );
+    CHECK( box_end( b ) );
+    if( p_fmp4->sar_width && p_fmp4->sar_height )
+    {
+        box_start( b, "pasp" );
+        put_be32( b, p_fmp4->sar_width );
+        put_be32( b, p_fmp4->sar_height );
+        CHECK( box_end( b ) );
+    }
+    CHECK( box_end( b ) );
+    CHECK( box_end( b ) );
+
+    /* all samples are described by the fragments */
+    full_box_start( b, "stts", 0, 0 );
+    put_be32( b, 0 );
+    CHECK( box_end( b ) );
+    full_box_start( b, "stsc", 0, 0 );
+    put_be32( b, 0 );
+    CHECK( box_end( b ) );
+    full_box_start( b, "stsz", 0, 0 );
+    put_be32( b, 0 );                   // sample size
+    put_be32( b, 0 );                   // sample count
+    CHECK( box_end( b ) );
+    full_box_start( b, "stco", 0, 0 );
+    put_be32( b, 0 );
+    CHECK( box_end( b ) );
+
+    CHECK( box_end( b ) ); // stbl
+    CHECK( box_end( b ) ); // minf
+    CHECK( box_end( b ) ); // mdia
+    CHECK( box_end( b ) ); // trak
+
+    box_start( b, "mvex" );
+    full_box_start( b, "trex", 0, 0 );
+    put_be32( b, TRACK_ID );
+    put_be32( b, 1 );                   // default sample description index
+    put_be32( b, 0 );                   // default sample duration
+    put_be32( b, 0 );                   // default sample size
+    put_be32( b, 0 );                   // default sample flags
+    CHECK( box_end( b ) );
+    CHECK( box_end( b ) );
+
+    CHECK( box_end( b ) ); // moov
+
+    return box_flush( p_fmp4, b );
+}
+
+/* Writes the buffered samples as one moof+mdat. i_next_dts is the decode time
+ * of the sample following the fragment, which gives the last sample its duration. */
+static int write_fragment( fmp4_hnd_t *p_fmp4, int64_t i_next_dts )
+{
+    box_buffer *b = &p_fmp4->box;
+    fmp4_sample_t *samples = p_fmp4->samples;
+    int i_samples = p_fmp4->i_samples;
+
+    if( !i_samples )
+        return 0;
+
+    box_start( b, "moof" );
+
+    full_box_start( b, "mfhd", 0, 0 );
+    put_be32( b, ++p_fmp4->i_sequence );
+    CHECK( box_end( b ) );
+
+    box_start( b, "traf" );
+
+    full_box_start( b, "tfhd", 0, 0x020000 ); // default-base-is-moof
+    put_be32( b, TRACK_ID );
+    CHECK( box_end( b ) );
+
+    full_box_start( b, "tfdt", 1, 0 );
+    put_be64( b, samples[0].i_dts );     // base media decode time
+    CHECK( box_end( b ) );
+
+    /* data-offset, sample-duration, sample-size, sample-flags, sample-composition-time-offset */
+    full_box_start( b, "trun", 0, 0x000f01 );
+    put_be32( b, i_samples );
+    unsigned data_offset_pos = b->d_cur;
+    put_be32( b, 0 );                    // data offset, written once the moof size is known
+    for( int i = 0; i < i_samples; i++ )
+    {
+        int64_t i_next = i + 1 < i_samples ? samples[i+1].i_dts : i_next_dts;
+        put_be32( b, i_next - samples[i].i_dts );
+        put_be32( b, samples[i].i_size );
+        put_be32( b, samples[i].i_flags );
+        put_be32( b, samples[i].i_cts - samples[i].i_dts );
+    }
+    p_fmp4->i_prev_duration = i_next_dts - samples[i_samples-1].i_dts;
+    CHECK( box_end( b ) ); // trun
+
+    CHECK( box_end( b ) ); // traf
+    CHECK( box_end( b ) ); // moof
+
+    uint32_t data_offset = b->d_cur + 8;
+    b->data[data_offset_pos+0] = data_offset >> 24;
+    b->data[data_offset_pos+1] = data_offset >> 16;
+    b->data[data_offset_pos+2] = data_offset >> 8;
+    b->data[data_offset_pos+3] = data_offset;
+
+    /* the sample data is written straight from the mdat buffer
+     * instead of being copied behind the moof */
+    put_be32( b, 8 + p_fmp4->mdat.d_cur );
+    put_tag( b, "mdat" );
+    CHECK( box_flush( p_fmp4, b ) );
+
+    if( fwrite( p_fmp4->mdat.data, p_fmp4->mdat.d_cur, 1, p_fmp4->fp ) != 1 )
+        return -1;
+    fflush( p_fmp4->fp );
+
+    p_fmp4->mdat.d_cur = 0;
+    p_fmp4->i_samples = 0;
+
+    return 0;
+}
+
+static int write_frame( hnd_t handle, uint8_t *p_nalu, int i_size, x264_picture_t *p_picture )
+{
+    fmp4_hnd_t *p_fmp4 = handle;
+
+    if( !p_fmp4->i_numframe )
+    {
+        /* segments share the timeline of the whole stream */
+        int64_t i_first_pts = p_fmp4->b_continuous ? p_fmp4->i_first_pts : p_picture->i_pts;
+        int64_t i_first_dts = p_fmp4->b_continuous ? p_fmp4->i_first_dts : p_picture->i_dts;
+        p_fmp4->i_delay_time = i_first_dts * -1;
+        CHECK( write_init_segment( p_fmp4, (i_first_pts + p_fmp4->i_delay_time) * p_fmp4->i_time_inc ) );
+    }
+
+    int64_t dts = (p_picture->i_dts + p_fmp4->i_delay_time) * p_fmp4->i_time_inc;
+    int64_t cts = (p_picture->i_pts + p_fmp4->i_delay_time) * p_fmp4->i_time_inc;
+
+    /* every fragment starts with a keyframe so that it can be decoded on its own */
+    if( p_picture->b_keyframe )
+        CHECK( write_fragment( p_fmp4, dts ) );
+
+    if( p_fmp4->i_samples == p_fmp4->i_samples_max )
+    {
+        int i_max = p_fmp4->i_samples_max ? p_fmp4->i_samples_max << 1 : 256;
+        fmp4_sample_t *samples = realloc( p_fmp4->samples, i_max * sizeof(fmp4_sample_t) );
+        if( !samples )
+            return -1;
+        p_fmp4->samples = samples;
+        p_fmp4->i_samples_max = i_max;
+    }
+
+    unsigned i_sample_size = i_size;
+    if( p_fmp4->sei )
+    {
+        CHECK( box_append( &p_fmp4->mdat, p_fmp4->sei, p_fmp4->sei_len ) );
+        i_sample_size += p_fmp4->sei_len;
+        free( p_fmp4->sei );
+        p_fmp4->sei = NULL;
+    }
+    CHECK( box_append( &p_fmp4->mdat, p_nalu, i_size ) );
+
+    fmp4_sample_t *sample = &p_fmp4->samples[p_fmp4->i_samples++];
+    sample->i_size = i_sample_size;
+    sample->i_dts = dts;
+    sample->i_cts = cts;
+    if( p_picture->b_keyframe )
+        sample->i_flags = SAMPLE_DEPENDS_ON_NONE;
+    else
+        sample->i_flags = SAMPLE_DEPENDS_ON_OTHERS | SAMPLE_IS_NON_SYNC;
+    if( p_picture->i_type == X264_TYPE_B )
+        sample->i_flags |= SAMPLE_NOT_DEPENDED_ON;
+
+    p_fmp4->i_numframe++;
+
+    return i_size;
+}
+
+static int close_file( hnd_t handle, int64_t largest_pts, int64_t second_largest_pts )
+{
+    fmp4_hnd_t *p_fmp4 = handle;
+    int ret = 0;
+
+    if( p_fmp4->i_samples )
+    {
+        int64_t i_last_delta = (largest_pts - second_largest_pts) * p_fmp4->i_time_inc;
+        if( i_last_delta <= 0 )
+            i_last_delta = p_fmp4->i_prev_duration > 0 ? p_fmp4->i_prev_duration : p_fmp4->i_time_inc;
+        ret = write_fragment( p_fmp4, p_fmp4->samples[p_fmp4->i_samples-1].i_dts + i_last_delta );
+    }
+
+    if( p_fmp4->fp && p_fmp4->fp != stdout )
+        fclose( p_fmp4->fp );
+    free( p_fmp4->box.data );
+    free( p_fmp4->mdat.data );
+    free( p_fmp4->samples );
+    free( p_fmp4->avcC );
+    free( p_fmp4->sei );
+    free( p_fmp4 );
+
+    return ret;
+}
+
+const cli_output_t fmp4_output = { open_file, set_param, write_headers, write_frame, close_file };
@@ -32,6 +32,12 @@
 typedef struct
 {
     int use_dts_compress;
+    double segment_duration;
+    /* set by the segmenter: timestamps of the first frame of the whole stream,
+     * so that every segment is muxed on the same timeline */
+    int b_continuous;
+    int64_t i_first_pts;
+    int64_t i_first_dts;
 } cli_output_opt_t;
 
 typedef struct
@@ -47,5 +53,13 @@ extern const cli_output_t raw_output;
 extern const cli_output_t mkv_output;
 extern const cli_output_t mp4_output;
 extern const cli_output_t flv_output;
+extern const cli_output_t fmp4_output;
+extern const cli_output_t ts_output;
+extern cli_output_t thread_output;
+/* total time the caller has spent waiting for the threaded muxer, in microseconds */
+int64_t thread_output_stall( hnd_t handle );
+extern cli_output_t segment_output;
+
+extern cli_output_t output;
 
 #endif
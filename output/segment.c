@@ -0,0 +1,401 @@
+/*****************************************************************************
+ * segment.c: keyframe-aligned segmented output
+ *****************************************************************************
+ * Copyright (C) 2003-2011 x264 project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ * This program is also available under a commercial proprietary license.
+ * For more information, contact us at licensing@x264.com.
+ *****************************************************************************/
+
+#include "output.h"
+
+#if SYS_WINDOWS
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/* Cuts the output into files of roughly segment_duration seconds, each starting
+ * with a keyframe.  Frames are collected in memory until the next cut; the whole
+ * segment is then muxed, written and synced to disk by a pool of writer threads
+ * while encoding continues.  An HLS playlist and a plain-text index are updated
+ * in order as segments complete. */
+
+/* number of segments that can be in flight before the encoder waits for the writers */
+#define SEGMENT_WRITERS 4
+
+typedef struct
+{
+    int64_t i_offset;
+    int i_size;
+    x264_picture_t pic;
+} segment_frame_t;
+
+typedef struct
+{
+    struct segment_hnd_t *h;
+    int i_index;
+    char *psz_filename;
+
+    uint8_t *data;
+    int64_t i_size;
+    int64_t i_alloc;
+    segment_frame_t *frames;
+    int i_frames;
+    int i_frames_alloc;
+
+    int64_t i_start_pts;
+    int64_t i_end_pts;   /* start of the next segment */
+    int status;
+} segment_t;
+
+typedef struct segment_hnd_t
+{
+    cli_output_t output;
+    cli_output_opt_t opt;
+    x264_param_t param;
+    x264_nal_t headers[3];
+    uint8_t *header_data;
+
+    char *psz_stem;      /* output filename without extension */
+    const char *psz_ext;
+    char *psz_playlist;
+    FILE *index;
+
+    x264_threadpool_t *pool;
+    segment_t *pending[SEGMENT_WRITERS];
+    int i_pending;
+    segment_t *cur;
+    int i_segments;
+    int status;
+
+    /* finished segments, for the playlist */
+    double *durations;
+    int i_durations;
+    double d_max_duration;
+    double d_timebase;
+} segment_hnd_t;
+
+static int sync_file( const char *psz_filename )
+{
+#if SYS_WINDOWS
+    FILE *f = fopen( psz_filename, "rb+" );
+    if( !f )
+        return -1;
+    int ret = _commit( _fileno( f ) );
+    fclose( f );
+    return ret;
+#else
+    int fd = open( psz_filename, O_RDONLY );
+    if( fd < 0 )
+        return -1;
+    int ret = fsync( fd );
+    close( fd );
+    return ret;
+#endif
+}
+
+static void segment_free( segment_t *seg )
+{
+    if( !seg )
+        return;
+    free( seg->psz_filename );
+    free( seg->data );
+    free( seg->frames );
+    free( seg );
+}
+
+static segment_t *segment_new( segment_hnd_t *h, int64_t i_start_pts )
+{
+    segment_t *seg = calloc( 1, sizeof(segment_t) );
+    if( !seg )
+        return NULL;
+    seg->h = h;
+    seg->i_index = h->i_segments++;
+    seg->i_start_pts = i_start_pts;
+    seg->psz_filename = malloc( strlen( h->psz_stem ) + strlen( h->psz_ext ) + 16 );
+    if( !seg->psz_filename )
+    {
+        free( seg );
+        return NULL;
+    }
+    sprintf( seg->psz_filename, "%s-%05d%s%s", h->psz_stem, seg->i_index, *h->psz_ext ? "." : "", h->psz_ext );
+    return seg;
+}
+
+/* runs in a writer thread: mux the buffered frames into the segment file */
+static void *segment_write( segment_t *seg )
+{
+    segment_hnd_t *h = seg->h;
+    cli_output_opt_t opt = h->opt;
+    x264_param_t param = h->param;
+    int64_t largest_pts = -1, second_largest_pts = -1;
+    hnd_t hout = NULL;
+
+    if( h->output.open_file( seg->psz_filename, &hout, &opt ) ||
+        h->output.set_param( hout, &param ) )
+        goto fail;
+    if( h->header_data && h->output.write_headers( hout, h->headers ) < 0 )
+        goto fail;
+    for( int i = 0; i < seg->i_frames; i++ )
+    {
+        segment_frame_t *frame = &seg->frames[i];
+        if( h->output.write_frame( hout, seg->data + frame->i_offset, frame->i_size, &frame->pic ) < 0 )
+            goto fail;
+        if( frame->pic.i_pts > largest_pts )
+        {
+            second_largest_pts = largest_pts;
+            largest_pts = frame->pic.i_pts;
+        }
+        else if( frame->pic.i_pts > second_largest_pts )
+            second_largest_pts = frame->pic.i_pts;
+    }
+    /* give the last frame the duration that follows from the next segment */
+    if( seg->i_end_pts > largest_pts )
+    {
+        second_largest_pts = largest_pts;
+        largest_pts = seg->i_end_pts;
+    }
+    hnd_t hclose = hout;
+    hout = NULL;
+    if( h->output.close_file( hclose, largest_pts, second_largest_pts ) < 0 ||
+        sync_file( seg->psz_filename ) )
+        goto fail;
+    return NULL;
+
+fail:
+    if( hout )
+        h->output.close_file( hout, largest_pts, second_largest_pts );
+    seg->status = -1;
+    return NULL;
+}
+
+static int write_playlist( segment_hnd_t *h, int b_final )
+{
+    FILE *f = fopen( h->psz_playlist, "w" );
+    if( !f )
+        return -1;
+    /* segment uris are relative to the playlist */
+    const char *stem = h->psz_stem + strlen( h->psz_stem );
+    while( stem > h->psz_stem && stem[-1] != '/' && stem[-1] != '\\' )
+        stem--;
+    fprintf( f, "#EXTM3U\n"
+                "#EXT-X-VERSION:3\n"
+                "#EXT-X-TARGETDURATION:%d\n"
+                "#EXT-X-MEDIA-SEQUENCE:0\n"
+                "#EXT-X-PLAYLIST-TYPE:%s\n",
+             (int)ceil( h->d_max_duration ), b_final ? "VOD" : "EVENT" );
+    for( int i = 0; i < h->i_durations; i++ )
+        fprintf( f, "#EXTINF:%.3f,\n%s-%05d%s%s\n", h->durations[i], stem, i, *h->psz_ext ? "." : "", h->psz_ext );
+    if( b_final )
+        fprintf( f, "#EXT-X-ENDLIST\n" );
+    return fclose( f ) ? -1 : 0;
+}
+
+/* collect the oldest pending segment and publish it */
+static int segment_finish( segment_hnd_t *h )
+{
+    segment_t *seg = h->pending[0];
+    if( h->pool )
+        x264_threadpool_wait( h->pool, seg );
+    memmove( h->pending, h->pending + 1, (--h->i_pending) * sizeof(segment_t*) );
+
+    int ret = seg->status;
+    if( ret )
+        x264_cli_log( "segment", X264_LOG_ERROR, "could not write segment `%s'\n", seg->psz_filename );
+    else
+    {
+        double duration = (seg->i_end_pts - seg->i_start_pts) * h->d_timebase;
+        double *durations = realloc( h->durations, (h->i_durations+1) * sizeof(double) );
+        if( !durations )
+            ret = -1;
+        else
+        {
+            h->durations = durations;
+            h->durations[h->i_durations++] = duration;
+            h->d_max_duration = X264_MAX( h->d_max_duration, duration );
+            fprintf( h->index, "%d,%s,%.6f,%.6f,%d,%"PRId64"\n", seg->i_index, seg->psz_filename,
+                     seg->i_start_pts * h->d_timebase, duration, seg->i_frames, seg->i_size );
+            fflush( h->index );
+            if( write_playlist( h, 0 ) )
+                ret = -1;
+        }
+    }
+    segment_free( seg );
+    return ret;
+}
+
+static int segment_submit( segment_hnd_t *h, int64_t i_end_pts )
+{
+    segment_t *seg = h->cur;
+    h->cur = NULL;
+    seg->i_end_pts = i_end_pts;
+    if( h->i_pending == SEGMENT_WRITERS && segment_finish( h ) )
+        h->status = -1;
+    h->pending[h->i_pending++] = seg;
+    if( h->pool )
+        x264_threadpool_run( h->pool, (void*)segment_write, seg );
+    else
+        segment_write( seg );
+    return h->status;
+}
+
+static int open_file( char *psz_filename, hnd_t *p_handle, cli_output_opt_t *opt )
+{
+    segment_hnd_t *h = calloc( 1, sizeof(segment_hnd_t) );
+    FAIL_IF_ERR( !h, "segment", "malloc failed\n" )
+    h->output = output;
+    h->opt = *opt;
+    *p_handle = h;
+
+    char *ext = get_filename_extension( psz_filename );
+    int stem_len = ext - psz_filename - (ext > psz_filename && ext[-1] == '.');
+    h->psz_stem = malloc( stem_len + 1 );
+    h->psz_playlist = malloc( stem_len + 16 );
+    FAIL_IF_ERR( !h->psz_stem || !h->psz_playlist, "segment", "malloc failed\n" )
+    memcpy( h->psz_stem, psz_filename, stem_len );
+    h->psz_stem[stem_len] = 0;
+    h->psz_ext = ext;
+    sprintf( h->psz_playlist, "%s.m3u8", h->psz_stem );
+
+    char *psz_index = malloc( stem_len + 16 );
+    FAIL_IF_ERR( !psz_index, "segment", "malloc failed\n" )
+    sprintf( psz_index, "%s-index.csv", h->psz_stem );
+    h->index = fopen( psz_index, "w" );
+    FAIL_IF_ERR( !h->index, "segment", "could not open index file `%s'\n", psz_index )
+    free( psz_index );
+    fprintf( h->index, "segment,file,start,duration,frames,bytes\n" );
+
+    /* without thread support, segments are written synchronously */
+    if( x264_threadpool_init( &h->pool, SEGMENT_WRITERS, NULL, NULL ) )
+        h->pool = NULL;
+
+    return 0;
+}
+
+static int set_param( hnd_t handle, x264_param_t *p_param )
+{
+    segment_hnd_t *h = handle;
+    h->param = *p_param;
+    h->d_timebase = (double)p_param->i_timebase_num / p_param->i_timebase_den;
+    return 0;
+}
+
+static int write_headers( hnd_t handle, x264_nal_t *p_nal )
+{
+    segment_hnd_t *h = handle;
+    int size = p_nal[0].i_payload + p_nal[1].i_payload + p_nal[2].i_payload;
+
+    /* every segment gets its own copy of the headers */
+    h->header_data = malloc( size );
+    if( !h->header_data )
+        return -1;
+    memcpy( h->header_data, p_nal[0].p_payload, size );
+    for( int i = 0, offset = 0; i < 3; i++ )
+    {
+        h->headers[i] = p_nal[i];
+        h->headers[i].p_payload = h->header_data + offset;
+        offset += p_nal[i].i_payload;
+    }
+    return size;
+}
+
+static int write_frame( hnd_t handle, uint8_t *p_nalu, int i_size, x264_picture_t *p_picture )
+{
+    segment_hnd_t *h = handle;
+
+    if( h->status )
+        return h->status;
+
+    if( !h->i_segments )
+    {
+        h->opt.b_continuous = 1;
+        h->opt.i_first_pts = p_picture->i_pts;
+        h->opt.i_first_dts = p_picture->i_dts;
+    }
+
+    if( h->cur && p_picture->b_keyframe &&
+        (p_picture->i_pts - h->cur->i_start_pts) * h->d_timebase >= h->opt.segment_duration )
+    {
+        if( segment_submit( h, p_picture->i_pts ) )
+            return -1;
+    }
+
+    if( !h->cur )
+    {
+        h->cur = segment_new( h, p_picture->i_pts );
+        if( !h->cur )
+            return -1;
+    }
+
+    segment_t *seg = h->cur;
+    if( seg->i_frames == seg->i_frames_alloc )
+    {
+        int i_alloc = seg->i_frames_alloc ? seg->i_frames_alloc << 1 : 64;
+        segment_frame_t *frames = realloc( seg->frames, i_alloc * sizeof(segment_frame_t) );
+        if( !frames )
+            return -1;
+        seg->frames = frames;
+        seg->i_frames_alloc = i_alloc;
+    }
+    if( seg->i_size + i_size > seg->i_alloc )
+    {
+        int64_t i_alloc = X264_MAX( seg->i_alloc << 1, seg->i_size + i_size );
+        uint8_t *data = realloc( seg->data, i_alloc );
+        if( !data )
+            return -1;
+        seg->data = data;
+        seg->i_alloc = i_alloc;
+    }
+    memcpy( seg->data + seg->i_size, p_nalu, i_size );
+    segment_frame_t *frame = &seg->frames[seg->i_frames++];
+    frame->i_offset = seg->i_size;
+    frame->i_size = i_size;
+    frame->pic = *p_picture;
+    seg->i_size += i_size;
+
+    return i_size;
+}
+
+static int close_file( hnd_t handle, int64_t largest_pts, int64_t second_largest_pts )
+{
+    segment_hnd_t *h = handle;
+    int ret = h->status;
+
+    if( h->cur && !ret )
+        ret = segment_submit( h, 2 * largest_pts - second_largest_pts );
+    while( h->i_pending )
+        if( segment_finish( h ) )
+            ret = -1;
+    if( !ret && h->i_durations )
+        ret = write_playlist( h, 1 );
+
+    if( h->pool )
+        x264_threadpool_delete( h->pool );
+    segment_free( h->cur );
+    if( h->index )
+        fclose( h->index );
+    free( h->durations );
+    free( h->header_data );
+    free( h->psz_stem );
+    free( h->psz_playlist );
+    free( h );
+    return ret;
+}
+
+cli_output_t segment_output = { open_file, set_param, write_headers, write_frame, close_file };
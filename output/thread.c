@@ -0,0 +1,207 @@
+/*****************************************************************************
+ * thread.c: threaded output
+ *****************************************************************************
+ * Copyright (C) 2003-2011 x264 project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ * This program is also available under a commercial proprietary license.
+ * For more information, contact us at licensing@x264.com.
+ *****************************************************************************/
+
+#include "output.h"
+
+/* number of frames that can be queued before the encoder has to wait for the muxer */
+#define THREAD_OUTPUT_FRAMES 16
+
+typedef struct
+{
+    uint8_t *data;
+    int i_size; /* 0 tells the writer thread to exit */
+    int i_alloc;
+    x264_picture_t pic;
+} thread_output_frame_t;
+
+typedef struct
+{
+    cli_output_t output;
+    hnd_t p_handle;
+    x264_pthread_t thread;
+    int b_thread_running;
+    thread_output_frame_t frames[THREAD_OUTPUT_FRAMES+1];
+    x264_sync_frame_list_t free;   /* frames that the encoding thread can fill */
+    x264_sync_frame_list_t filled; /* frames waiting to be written, in order */
+    int status;                    /* first error returned by the muxer, protected by free.mutex */
+    int64_t i_stall;               /* time the encoding thread spent waiting for a free frame */
+} thread_hnd_t;
+
+static void list_delete( x264_sync_frame_list_t *slist )
+{
+    /* the entries aren't x264_frame_t, so keep x264_sync_frame_list_delete from freeing them */
+    for( int i = 0; slist->list && slist->list[i]; i++ )
+        slist->list[i] = NULL;
+    x264_sync_frame_list_delete( slist );
+}
+
+/* the sync lists are LIFO, but the muxer has to see the frames in order */
+static thread_output_frame_t *shift_filled( thread_hnd_t *h )
+{
+    x264_sync_frame_list_t *slist = &h->filled;
+    x264_pthread_mutex_lock( &slist->mutex );
+    while( !slist->i_size )
+        x264_pthread_cond_wait( &slist->cv_fill, &slist->mutex );
+    thread_output_frame_t *frame = (void*)x264_frame_shift( slist->list );
+    slist->i_size--;
+    x264_pthread_cond_broadcast( &slist->cv_empty );
+    x264_pthread_mutex_unlock( &slist->mutex );
+    return frame;
+}
+
+static int get_status( thread_hnd_t *h )
+{
+    x264_pthread_mutex_lock( &h->free.mutex );
+    int status = h->status;
+    x264_pthread_mutex_unlock( &h->free.mutex );
+    return status;
+}
+
+static void set_status( thread_hnd_t *h, int status )
+{
+    x264_pthread_mutex_lock( &h->free.mutex );
+    h->status = status;
+    x264_pthread_mutex_unlock( &h->free.mutex );
+}
+
+static void *write_frame_thread( thread_hnd_t *h )
+{
+    while( 1 )
+    {
+        thread_output_frame_t *frame = shift_filled( h );
+        if( !frame->i_size )
+            break;
+        if( !get_status( h ) )
+        {
+            int ret = h->output.write_frame( h->p_handle, frame->data, frame->i_size, &frame->pic );
+            if( ret < 0 )
+                set_status( h, ret );
+        }
+        x264_sync_frame_list_push( &h->free, (void*)frame );
+    }
+    return NULL;
+}
+
+static int open_file( char *psz_filename, hnd_t *p_handle, cli_output_opt_t *opt )
+{
+    thread_hnd_t *h = calloc( 1, sizeof(thread_hnd_t) );
+    FAIL_IF_ERR( !h, "x264", "malloc failed\n" )
+    h->output = output;
+    h->p_handle = *p_handle;
+    *p_handle = h;
+
+    /* one extra slot so that the exit request never blocks */
+    if( x264_sync_frame_list_init( &h->free, THREAD_OUTPUT_FRAMES+1 ) ||
+        x264_sync_frame_list_init( &h->filled, THREAD_OUTPUT_FRAMES+1 ) )
+        return -1;
+    for( int i = 0; i < THREAD_OUTPUT_FRAMES; i++ )
+        x264_sync_frame_list_push( &h->free, (void*)&h->frames[i] );
+
+    if( x264_pthread_create( &h->thread, NULL, (void*)write_frame_thread, h ) )
+        return -1;
+    h->b_thread_running = 1;
+    return 0;
+}
+
+static int set_param( hnd_t handle, x264_param_t *p_param )
+{
+    thread_hnd_t *h = handle;
+    return h->output.set_param( h->p_handle, p_param );
+}
+
+static int write_headers( hnd_t handle, x264_nal_t *p_nal )
+{
+    thread_hnd_t *h = handle;
+    return h->output.write_headers( h->p_handle, p_nal );
+}
+
+static int write_frame( hnd_t handle, uint8_t *p_nalu, int i_size, x264_picture_t *p_picture )
+{
+    thread_hnd_t *h = handle;
+
+    /* the nal buffer is only valid until the next call to x264_encoder_encode,
+     * so it has to be copied before it can be handed to the writer thread. */
+    int64_t i_start = x264_mdate();
+    thread_output_frame_t *frame = (void*)x264_sync_frame_list_pop( &h->free );
+    h->i_stall += x264_mdate() - i_start;
+
+    int status = get_status( h );
+    if( status )
+    {
+        x264_sync_frame_list_push( &h->free, (void*)frame );
+        return status;
+    }
+
+    if( frame->i_alloc < i_size )
+    {
+        free( frame->data );
+        frame->i_alloc = i_size + (i_size >> 2);
+        frame->data = malloc( frame->i_alloc );
+        if( !frame->data )
+        {
+            frame->i_alloc = 0;
+            x264_sync_frame_list_push( &h->free, (void*)frame );
+            return -1;
+        }
+    }
+    memcpy( frame->data, p_nalu, i_size );
+    frame->i_size = i_size;
+    frame->pic = *p_picture;
+    x264_sync_frame_list_push( &h->filled, (void*)frame );
+
+    return i_size;
+}
+
+int64_t thread_output_stall( hnd_t handle )
+{
+    thread_hnd_t *h = handle;
+    return h->i_stall;
+}
+
+static int close_file( hnd_t handle, int64_t largest_pts, int64_t second_largest_pts )
+{
+    thread_hnd_t *h = handle;
+    if( h->b_thread_running )
+    {
+        thread_output_frame_t *exit_request = &h->frames[THREAD_OUTPUT_FRAMES];
+        exit_request->i_size = 0;
+        x264_sync_frame_list_push( &h->filled, (void*)exit_request );
+        x264_pthread_join( h->thread, NULL );
+    }
+    int status = get_status( h );
+    if( status )
+        x264_cli_log( "x264", X264_LOG_ERROR, "error writing frame to output file\n" );
+    else if( h->i_stall >= 1000000 )
+        x264_cli_log( "x264", X264_LOG_INFO, "encoding stalled for %.2fs waiting on output\n", h->i_stall / 1e6 );
+    int ret = h->output.close_file( h->p_handle, largest_pts, second_largest_pts );
+    if( status )
+        ret = status;
+    for( int i = 0; i < THREAD_OUTPUT_FRAMES; i++ )
+        free( h->frames[i].data );
+    list_delete( &h->free );
+    list_delete( &h->filled );
+    free( h );
+    return ret;
+}
+
+cli_output_t thread_output = { open_file, set_param, write_headers, write_frame, close_file };
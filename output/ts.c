@@ -0,0 +1,360 @@
+/*****************************************************************************
+ * ts.c: mpeg-2 transport stream muxer
+ *****************************************************************************
+ * Copyright (C) 2003-2011 x264 project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ * This program is also available under a commercial proprietary license.
+ * For more information, contact us at licensing@x264.com.
+ *****************************************************************************/
+
+#include "output.h"
+
+#define TS_PACKET_SIZE   188
+#define TS_PAT_PID       0x0000
+#define TS_PMT_PID       0x1000
+#define TS_VIDEO_PID     0x0100
+#define TS_STREAM_ID     0xe0
+#define TS_STREAM_TYPE_H264 0x1b
+
+#define TS_CLOCK         90000
+/* PAT/PMT are repeated at every keyframe and at least this often */
+#define TS_PSI_INTERVAL  (TS_CLOCK / 10)
+/* maximum distance between two pcrs allowed by the spec */
+#define TS_PCR_INTERVAL  (TS_CLOCK / 10)
+/* decoder buffering delay used when neither hrd timing nor a vbv is available */
+#define TS_DEFAULT_DELAY (TS_CLOCK * 7 / 10)
+
+typedef struct
+{
+    FILE *fp;
+
+    uint8_t *buf;
+    unsigned d_cur;
+    unsigned d_max;
+
+    double d_timebase;
+    int b_hrd;
+    int64_t i_delay;        /* pcr to dts distance in 90kHz ticks without hrd timing */
+    int64_t i_delay_time;   /* offset that makes the first dts zero */
+    int b_continuous;
+    int64_t i_first_dts;
+    int64_t i_last_psi;
+    int64_t i_last_pcr;     /* on the 27MHz system clock */
+    int64_t i_numframe;
+
+    uint8_t cc_pat, cc_pmt, cc_video;
+} ts_hnd_t;
+
+static uint32_t crc32_mpeg( const uint8_t *data, int len )
+{
+    uint32_t crc = 0xffffffff;
+    while( len-- )
+    {
+        crc ^= (uint32_t)*data++ << 24;
+        for( int i = 0; i < 8; i++ )
+            crc = (crc << 1) ^ (crc & 0x80000000 ? 0x04c11db7 : 0);
+    }
+    return crc;
+}
+
+static uint8_t *ts_new_packet( ts_hnd_t *p_ts )
+{
+    if( p_ts->d_cur + TS_PACKET_SIZE > p_ts->d_max )
+    {
+        unsigned dn = p_ts->d_max ? p_ts->d_max << 1 : TS_PACKET_SIZE * 64;
+        uint8_t *dp = realloc( p_ts->buf, dn );
+        if( !dp )
+            return NULL;
+        p_ts->buf = dp;
+        p_ts->d_max = dn;
+    }
+    uint8_t *pkt = p_ts->buf + p_ts->d_cur;
+    p_ts->d_cur += TS_PACKET_SIZE;
+    return pkt;
+}
+
+static int ts_write_section( ts_hnd_t *p_ts, int pid, uint8_t *cc, const uint8_t *section, int len )
+{
+    uint8_t *pkt = ts_new_packet( p_ts );
+    if( !pkt )
+        return -1;
+    pkt[0] = 0x47;
+    pkt[1] = 0x40 | (pid >> 8); // payload unit start
+    pkt[2] = pid;
+    pkt[3] = 0x10 | (*cc & 0xf); // payload only
+    *cc = *cc + 1;
+    pkt[4] = 0;                  // pointer field
+    memcpy( pkt + 5, section, len );
+    uint32_t crc = crc32_mpeg( section, len );
+    pkt[5+len+0] = crc >> 24;
+    pkt[5+len+1] = crc >> 16;
+    pkt[5+len+2] = crc >> 8;
+    pkt[5+len+3] = crc;
+    memset( pkt + 9 + len, 0xff, TS_PACKET_SIZE - 9 - len );
+    return 0;
+}
+
+static void ts_put_pcr( uint8_t *af, int64_t pcr )
+{
+    int64_t pcr_base = (pcr / 300) & 0x1ffffffffLL;
+    int pcr_ext = pcr % 300;
+    af[2] = pcr_base >> 25;
+    af[3] = pcr_base >> 17;
+    af[4] = pcr_base >> 9;
+    af[5] = pcr_base >> 1;
+    af[6] = ((pcr_base & 1) << 7) | 0x7e | (pcr_ext >> 8);
+    af[7] = pcr_ext;
+}
+
+/* below 10fps one pcr per frame is too sparse, so fill the gap since the
+ * previous frame with packets that carry nothing but a pcr */
+static int ts_write_pcr_fill( ts_hnd_t *p_ts, int64_t pcr )
+{
+    int64_t gap = pcr - p_ts->i_last_pcr;
+    int count = (gap - 1) / (TS_PCR_INTERVAL * 300);
+    for( int i = 1; i <= count; i++ )
+    {
+        uint8_t *pkt = ts_new_packet( p_ts );
+        if( !pkt )
+            return -1;
+        pkt[0] = 0x47;
+        pkt[1] = TS_VIDEO_PID >> 8;
+        pkt[2] = TS_VIDEO_PID & 0xff;
+        pkt[3] = 0x20 | ((p_ts->cc_video - 1) & 0xf); // adaptation field only, cc isn't incremented
+        pkt[4] = TS_PACKET_SIZE - 5;
+        pkt[5] = 0x10;                                 // pcr
+        ts_put_pcr( pkt + 4, p_ts->i_last_pcr + gap * i / (count + 1) );
+        memset( pkt + 12, 0xff, TS_PACKET_SIZE - 12 );
+    }
+    return 0;
+}
+
+static int ts_write_psi( ts_hnd_t *p_ts )
+{
+    static const uint8_t pat[] =
+    {
+        0x00,                       // table id
+        0xb0, 13,                   // section syntax, section length
+        0x00, 0x01,                 // transport stream id
+        0xc1,                       // version 0, current
+        0x00, 0x00,                 // section number, last section number
+        0x00, 0x01,                 // program number
+        0xe0 | (TS_PMT_PID >> 8), TS_PMT_PID & 0xff,
+    };
+    static const uint8_t pmt[] =
+    {
+        0x02,                       // table id
+        0xb0, 18,                   // section syntax, section length
+        0x00, 0x01,                 // program number
+        0xc1,                       // version 0, current
+        0x00, 0x00,                 // section number, last section number
+        0xe0 | (TS_VIDEO_PID >> 8), TS_VIDEO_PID & 0xff, // pcr pid
+        0xf0, 0x00,                 // program info length
+        TS_STREAM_TYPE_H264,
+        0xe0 | (TS_VIDEO_PID >> 8), TS_VIDEO_PID & 0xff,
+        0xf0, 0x00,                 // es info length
+    };
+    if( ts_write_section( p_ts, TS_PAT_PID, &p_ts->cc_pat, pat, sizeof(pat) ) ||
+        ts_write_section( p_ts, TS_PMT_PID, &p_ts->cc_pmt, pmt, sizeof(pmt) ) )
+        return -1;
+    return 0;
+}
+
+static void ts_put_timestamp( uint8_t *p, int marker, int64_t ts )
+{
+    p[0] = (marker << 4) | ((ts >> 29) & 0xe) | 1;
+    p[1] = ts >> 22;
+    p[2] = ((ts >> 14) & 0xfe) | 1;
+    p[3] = ts >> 7;
+    p[4] = ((ts << 1) & 0xfe) | 1;
+}
+
+static int open_file( char *psz_filename, hnd_t *p_handle, cli_output_opt_t *opt )
+{
+    *p_handle = NULL;
+    ts_hnd_t *p_ts = calloc( 1, sizeof(ts_hnd_t) );
+    if( !p_ts )
+        return -1;
+
+    if( !strcmp( psz_filename, "-" ) )
+        p_ts->fp = stdout;
+    else
+        p_ts->fp = fopen( psz_filename, "wb" );
+    if( !p_ts->fp )
+    {
+        free( p_ts );
+        return -1;
+    }
+    p_ts->b_continuous = opt->b_continuous;
+    p_ts->i_first_dts = opt->i_first_dts;
+
+    *p_handle = p_ts;
+    return 0;
+}
+
+static int set_param( hnd_t handle, x264_param_t *p_param )
+{
+    ts_hnd_t *p_ts = handle;
+
+    p_ts->d_timebase = (double)p_param->i_timebase_num / p_param->i_timebase_den;
+    p_ts->b_hrd = p_param->i_nal_hrd != X264_NAL_HRD_NONE;
+    if( p_param->rc.i_vbv_buffer_size > 0 && p_param->rc.i_vbv_max_bitrate > 0 )
+        p_ts->i_delay = (int64_t)p_param->rc.i_vbv_buffer_size * TS_CLOCK / p_param->rc.i_vbv_max_bitrate;
+    else
+        p_ts->i_delay = TS_DEFAULT_DELAY;
+
+    return 0;
+}
+
+static int write_headers( hnd_t handle, x264_nal_t *p_nal )
+{
+    /* headers are repeated in-band after the AUD of every keyframe */
+    return 0;
+}
+
+static int write_frame( hnd_t handle, uint8_t *p_nalu, int i_size, x264_picture_t *p_picture )
+{
+    ts_hnd_t *p_ts = handle;
+
+#define convert_timebase_90k( timestamp ) (int64_t)((timestamp) * p_ts->d_timebase * TS_CLOCK + 0.5)
+
+    /* segments share the timeline of the whole stream */
+    if( !p_ts->i_numframe )
+        p_ts->i_delay_time = (p_ts->b_continuous ? p_ts->i_first_dts : p_picture->i_dts) * -1;
+
+    /* pcr is on the 27MHz system clock, pts/dts on 90kHz */
+    int64_t dts, pts, pcr;
+    if( p_ts->b_hrd )
+    {
+        dts = (int64_t)(p_picture->hrd_timing.cpb_removal_time * TS_CLOCK + 0.5);
+        pts = (int64_t)(p_picture->hrd_timing.dpb_output_time * TS_CLOCK + 0.5);
+        pcr = (int64_t)(p_picture->hrd_timing.cpb_initial_arrival_time * TS_CLOCK * 300 + 0.5);
+    }
+    else
+    {
+        dts = convert_timebase_90k( p_picture->i_dts + p_ts->i_delay_time ) + p_ts->i_delay;
+        pts = convert_timebase_90k( p_picture->i_pts + p_ts->i_delay_time ) + p_ts->i_delay;
+        pcr = (dts - p_ts->i_delay) * 300;
+    }
+
+    if( p_ts->i_numframe && ts_write_pcr_fill( p_ts, pcr ) )
+        return -1;
+    p_ts->i_last_pcr = pcr;
+
+    if( !p_ts->i_numframe || p_picture->b_keyframe || dts - p_ts->i_last_psi >= TS_PSI_INTERVAL )
+    {
+        if( ts_write_psi( p_ts ) )
+            return -1;
+        p_ts->i_last_psi = dts;
+    }
+
+    /* pes header, length 0 is allowed for video and avoids the 64KB limit */
+    uint8_t pes[19];
+    int pes_len = pts != dts ? 19 : 14;
+    pes[0] = 0;
+    pes[1] = 0;
+    pes[2] = 1;
+    pes[3] = TS_STREAM_ID;
+    pes[4] = 0;
+    pes[5] = 0;
+    pes[6] = 0x84;                   // marker, data alignment
+    pes[7] = pts != dts ? 0xc0 : 0x80;
+    pes[8] = pes_len - 9;
+    ts_put_timestamp( pes + 9, pts != dts ? 3 : 2, pts & 0x1ffffffffLL );
+    if( pts != dts )
+        ts_put_timestamp( pes + 14, 1, dts & 0x1ffffffffLL );
+
+    const uint8_t *chunks[2] = { pes, p_nalu };
+    int chunk_len[2] = { pes_len, i_size };
+    int total = pes_len + i_size;
+    int chunk = 0, chunk_pos = 0;
+
+    for( int first = 1; total > 0; first = 0 )
+    {
+        uint8_t *pkt = ts_new_packet( p_ts );
+        if( !pkt )
+            return -1;
+        pkt[0] = 0x47;
+        pkt[1] = (first ? 0x40 : 0) | (TS_VIDEO_PID >> 8);
+        pkt[2] = TS_VIDEO_PID & 0xff;
+        pkt[3] = p_ts->cc_video++ & 0xf;
+
+        /* the first packet of each frame carries the pcr */
+        int af_len = first ? 8 : 0;
+        int payload = X264_MIN( total, TS_PACKET_SIZE - 4 - af_len );
+        if( TS_PACKET_SIZE - 4 - af_len > total )
+            af_len = TS_PACKET_SIZE - 4 - total;
+
+        if( af_len )
+        {
+            uint8_t *af = pkt + 4;
+            pkt[3] |= 0x30;
+            af[0] = af_len - 1;
+            if( af_len > 1 )
+            {
+                af[1] = 0;
+                memset( af + 2, 0xff, af_len - 2 );
+            }
+            if( first )
+            {
+                af[1] = 0x10 | (p_picture->b_keyframe ? 0x40 : 0); // pcr, random access
+                ts_put_pcr( af, pcr );
+            }
+        }
+        else
+            pkt[3] |= 0x10;
+
+        uint8_t *dst = pkt + 4 + af_len;
+        total -= payload;
+        while( payload )
+        {
+            int len = X264_MIN( payload, chunk_len[chunk] - chunk_pos );
+            memcpy( dst, chunks[chunk] + chunk_pos, len );
+            dst += len;
+            payload -= len;
+            chunk_pos += len;
+            if( chunk_pos == chunk_len[chunk] )
+            {
+                chunk++;
+                chunk_pos = 0;
+            }
+        }
+    }
+
+    /* flush every frame so that downstream receivers see it immediately */
+    if( fwrite( p_ts->buf, p_ts->d_cur, 1, p_ts->fp ) != 1 )
+        return -1;
+    fflush( p_ts->fp );
+    p_ts->d_cur = 0;
+    p_ts->i_numframe++;
+
+    return i_size;
+}
+
+static int close_file( hnd_t handle, int64_t largest_pts, int64_t second_largest_pts )
+{
+    ts_hnd_t *p_ts = handle;
+
+    if( p_ts->fp && p_ts->fp != stdout )
+        fclose( p_ts->fp );
+    free( p_ts->buf );
+    free( p_ts );
+
+    return 0;
+}
+
+const cli_output_t ts_output = { open_file, set_param, write_headers, write_frame, close_file };
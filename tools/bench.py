@@ -0,0 +1,284 @@
+#!/usr/bin/env python
+#
+# Whole-encoder benchmark.
+#
+# Runs x264 over a matrix of synthetic sequences, resolutions, presets, thread
+# counts and ratecontrol modes and prints the results as JSON, so that builds
+# can be compared without any external media.
+#
+# The sequences are generated on the fly and fed to x264 through a pipe.  The
+# output is read as an MPEG-TS stream, which x264 flushes after every frame;
+# the time between handing a frame to the encoder and seeing its PES start on
+# the output gives the per-frame latency.  Peak RSS comes from the child's
+# rusage.  If x264 supports --timing (libx264 configured with --enable-timing),
+# the per-stage times are included as well.
+#
+# usage: bench.py [options] > results.json
+#        make bench BENCHFLAGS="--presets medium --threads 1,4"
+
+import json
+import os
+import platform
+import random
+import re
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+from optparse import OptionParser
+
+TS_PACKET_SIZE = 188
+
+CONTENTS = ("gradient", "noise", "pan", "cuts")
+
+RC_MODES = {
+    "crf": "--crf %s",
+    "cqp": "--qp %s",
+    "abr": "--bitrate %s",
+    "cbr": "--bitrate %s --vbv-maxrate %s --vbv-bufsize %s",
+}
+
+# sequence generation
+
+def noise_bytes(rng, size):
+    return bytearray(rng.getrandbits(8) for i in range(size))
+
+class Sequence(object):
+    """Planar 4:2:0 frames built from row slices of precomputed buffers, so that
+    even large resolutions can be generated faster than they are encoded."""
+    def __init__(self, content, width, height, frames, seed=0):
+        self.content = content
+        self.width = width
+        self.height = height
+        self.frames = frames
+        self.rng = random.Random(seed)
+        self.planes = ((width, height), (width // 2, height // 2), (width // 2, height // 2))
+        if content in ("gradient", "cuts"):
+            span = width + height + 4 * frames
+            self.ramp = bytearray(i & 255 for i in range(span))
+        if content in ("noise", "cuts"):
+            size = width * height * 3 // 2
+            self.noise = noise_bytes(self.rng, size * 2)
+        if content in ("pan", "cuts"):
+            self.textures = [self.make_texture(w + 3 * frames, h + frames) for w, h in self.planes]
+
+    def make_texture(self, width, height, block=8):
+        # blocky smooth-ish texture: upscaled noise, so motion search has something to lock on to
+        rows = []
+        for y in range((height + block - 1) // block):
+            small = noise_bytes(self.rng, (width + block - 1) // block)
+            row = bytearray()
+            for b in small:
+                row += bytearray([b]) * block
+            rows += [row[:width]] * block
+        return rows[:height]
+
+    def gradient(self, i):
+        out = bytearray()
+        for p, (w, h) in enumerate(self.planes):
+            shift = 2 * i + p * 37
+            for y in range(h):
+                out += self.ramp[y + shift:y + shift + w]
+        return out
+
+    def noise_frame(self, i):
+        size = self.width * self.height * 3 // 2
+        offset = (i * 7919) % size
+        return self.noise[offset:offset + size]
+
+    def pan(self, i):
+        out = bytearray()
+        for p, (w, h) in enumerate(self.planes):
+            dx = (3 * i) >> (p > 0)
+            dy = i >> (p > 0)
+            tex = self.textures[p]
+            for y in range(h):
+                out += tex[y + dy][dx:dx + w]
+        return out
+
+    def frame(self, i):
+        content = self.content
+        if content == "cuts":
+            # a scene cut every 24 frames
+            content = ("gradient", "pan", "noise")[(i // 24) % 3]
+        if content == "gradient":
+            return self.gradient(i)
+        if content == "noise":
+            return self.noise_frame(i)
+        return self.pan(i)
+
+    def y4m_header(self):
+        return ("YUV4MPEG2 W%d H%d F25:1 Ip A1:1 C420jpeg\n" % (self.width, self.height)).encode()
+
+# encoding
+
+def percentile(values, p):
+    if not values:
+        return None
+    values = sorted(values)
+    k = (len(values) - 1) * p / 100.0
+    lo = int(k)
+    hi = min(lo + 1, len(values) - 1)
+    return values[lo] + (values[hi] - values[lo]) * (k - lo)
+
+def run_encode(x264, seq, args, timing=False):
+    cmd = [x264, "--muxer", "ts", "--demuxer", "y4m", "--no-progress", "-o", "-"] + args + ["-"]
+    if timing:
+        fd, timing_file = tempfile.mkstemp(suffix=".json")
+        os.close(fd)
+        cmd[1:1] = ["--timing", timing_file]
+    proc = subprocess.Popen(cmd, stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    sent = []
+    errors = []
+
+    def feed():
+        try:
+            proc.stdin.write(seq.y4m_header())
+            for i in range(seq.frames):
+                frame = seq.frame(i)
+                proc.stdin.write(b"FRAME\n")
+                proc.stdin.write(bytes(frame))
+                sent.append(time.time())
+            proc.stdin.close()
+        except (IOError, OSError) as e:
+            errors.append(str(e))
+
+    stderr = []
+    def drain():
+        stderr.append(proc.stderr.read())
+
+    start = time.time()
+    threads = [threading.Thread(target=feed), threading.Thread(target=drain)]
+    for t in threads:
+        t.start()
+
+    received = []
+    size = 0
+    pending = b""
+    while True:
+        chunk = proc.stdout.read(TS_PACKET_SIZE * 16)
+        if not chunk:
+            break
+        now = time.time()
+        size += len(chunk)
+        pending += chunk
+        while len(pending) >= TS_PACKET_SIZE:
+            pkt = bytearray(pending[:TS_PACKET_SIZE])
+            pending = pending[TS_PACKET_SIZE:]
+            pid = ((pkt[1] & 0x1f) << 8) | pkt[2]
+            if pkt[1] & 0x40 and pid == 0x100:
+                received.append(now)
+    end = time.time()
+    for t in threads:
+        t.join()
+
+    try:
+        rusage = os.wait4(proc.pid, 0)[2]
+        peak_rss = rusage.ru_maxrss
+        if sys.platform == "darwin":
+            peak_rss //= 1024
+        proc.returncode = 0
+    except (AttributeError, OSError):
+        proc.wait()
+        peak_rss = None
+
+    log = b"".join(stderr).decode("utf-8", "replace")
+    m = re.search(r"encoded (\d+) frames, ([\d.]+) fps", log)
+    if not m or errors or len(received) != seq.frames:
+        raise RuntimeError("encode failed: %s\n%s" % (" ".join(cmd), log))
+
+    # frames leave the encoder in decode order, which only differs from the input
+    # order by the b-frame delay, so pairing them by index is close enough
+    latencies = [(r - s) * 1000 for s, r in zip(sent, received)]
+    result = {
+        "frames": seq.frames,
+        "fps": seq.frames / (end - start),
+        "x264_fps": float(m.group(2)),
+        "ts_kbps": size * 8 / 1000.0 * 25 / seq.frames,
+        "latency_ms": dict(("p%d" % p, percentile(latencies, p)) for p in (50, 90, 99, 100)),
+        "peak_rss_kb": peak_rss,
+    }
+    if timing:
+        try:
+            result["stages"] = json.load(open(timing_file))["stages"]
+        except (IOError, ValueError, KeyError):
+            pass
+        os.remove(timing_file)
+    return result
+
+def rc_args(rc):
+    mode, _, value = rc.partition(":")
+    if mode not in RC_MODES:
+        raise ValueError("unknown ratecontrol mode `%s'" % mode)
+    if mode == "cbr":
+        return (RC_MODES[mode] % (value, value, value)).split()
+    return (RC_MODES[mode] % value).split()
+
+def x264_has_timing(x264):
+    try:
+        out = subprocess.Popen([x264, "--fullhelp"], stdout=subprocess.PIPE, stderr=subprocess.PIPE).communicate()[0]
+        return b"--timing" in out
+    except OSError:
+        return False
+
+def x264_version(x264):
+    try:
+        out = subprocess.Popen([x264, "--version"], stdout=subprocess.PIPE, stderr=subprocess.PIPE).communicate()[0]
+        return out.decode("utf-8", "replace").splitlines()[0]
+    except (OSError, IndexError):
+        return None
+
+def split(value):
+    return [v for v in value.split(",") if v]
+
+def main():
+    parser = OptionParser(usage="%prog [options]")
+    parser.add_option("--x264", default="./x264", help="x264 binary [%default]")
+    parser.add_option("--content", default="gradient,noise,pan,cuts",
+                      help="synthetic sequences: %s [%%default]" % ", ".join(CONTENTS))
+    parser.add_option("--res", default="416x240,1280x720", help="resolutions [%default]")
+    parser.add_option("--frames", type="int", default=60, help="frames per sequence [%default]")
+    parser.add_option("--presets", default="ultrafast,veryfast,medium", help="presets [%default]")
+    parser.add_option("--threads", default="1,0", help="thread counts, 0 is auto [%default]")
+    parser.add_option("--rc", default="crf:23,cbr:2000",
+                      help="ratecontrol modes, crf:<f>, cqp:<qp>, abr:<kbps> or cbr:<kbps> [%default]")
+    parser.add_option("--extra", default="", help="additional x264 options")
+    parser.add_option("-o", "--output", help="write the JSON results to FILE instead of stdout", metavar="FILE")
+    options, args = parser.parse_args()
+
+    timing = x264_has_timing(options.x264)
+    results = []
+    for content in split(options.content):
+        if content not in CONTENTS:
+            parser.error("unknown content `%s'" % content)
+        for res in split(options.res):
+            width, height = [int(v) for v in res.split("x")]
+            seq = Sequence(content, width, height, options.frames)
+            for preset in split(options.presets):
+                for threads in split(options.threads):
+                    for rc in split(options.rc):
+                        args = ["--preset", preset, "--threads", threads] + rc_args(rc) + options.extra.split()
+                        sys.stderr.write("%s %s %s threads=%s %s\n" % (content, res, preset, threads, rc))
+                        result = {
+                            "content": content,
+                            "resolution": res,
+                            "preset": preset,
+                            "threads": int(threads),
+                            "rc": rc,
+                        }
+                        result.update(run_encode(options.x264, seq, args, timing))
+                        results.append(result)
+
+    report = {
+        "x264": x264_version(options.x264),
+        "host": {"machine": platform.machine(), "system": platform.system(), "node": platform.node()},
+        "results": results,
+    }
+    out = open(options.output, "w") if options.output else sys.stdout
+    json.dump(report, out, indent=2, sort_keys=True)
+    out.write("\n")
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -163,6 +163,7 @@ static void print_bench(void)
             if( k < j )
                 continue;
             printf( "%s_%s%s: %"PRId64"\n", benchs[i].name,
+                    b->cpu&X264_CPU_AVX2 ? "avx2" :
                     b->cpu&X264_CPU_AVX ? "avx" :
                     b->cpu&X264_CPU_SSE4 ? "sse4" :
                     b->cpu&X264_CPU_SHUFFLE_IS_FAST ? "fastshuffle" :
@@ -1183,12 +1184,16 @@ static int check_mc( int cpu_ref, int cpu_new )
         pixel *dsta[4] = { pbuf4, pbuf4+1024, pbuf4+2048, pbuf4+3072 };
         set_func_name( "lowres_init" );
         ok = 1; used_asm = 1;
-        for( int w = 40; w <= 48; w += 8 )
+        /* the widths above 64 that aren't multiples of 32 exercise split implementations */
+        static const int widths[] = { 40, 48, 56, 64, 72, 88, 96, 104, 120, 128 };
+        for( int n = 0; n < sizeof(widths)/sizeof(*widths); n++ )
         {
+            int w = widths[n];
             int stride = (w+8)&~15;
-            call_c( mc_c.frame_init_lowres_core, pbuf1, dstc[0], dstc[1], dstc[2], dstc[3], w*2, stride, w, 16 );
-            call_a( mc_a.frame_init_lowres_core, pbuf1, dsta[0], dsta[1], dsta[2], dsta[3], w*2, stride, w, 16 );
-            for( int i = 0; i < 16; i++ )
+            int height = w > 64 ? 8 : 16;
+            call_c( mc_c.frame_init_lowres_core, pbuf1, dstc[0], dstc[1], dstc[2], dstc[3], w*2, stride, w, height );
+            call_a( mc_a.frame_init_lowres_core, pbuf1, dsta[0], dsta[1], dsta[2], dsta[3], w*2, stride, w, height );
+            for( int i = 0; i < height; i++ )
             {
                 for( int j = 0; j < 4; j++ )
                     if( memcmp( dstc[j]+i*stride, dsta[j]+i*stride, w * sizeof(pixel) ) )
@@ -1266,6 +1271,50 @@ static int check_mc( int cpu_ref, int cpu_new )
         report( "mbtree propagate :" );
     }
 
+    if( mc_a.mbtree_propagate_list != mc_ref.mbtree_propagate_list )
+    {
+        x264_t h_buf;
+        x264_t *h = &h_buf;
+        memset( h, 0, sizeof(*h) );
+        /* an odd width, so the asm has a partial group at the end of the row */
+        h->mb.i_mb_width = h->mb.i_mb_stride = 13;
+        h->mb.i_mb_height = 7;
+        ok = 1; used_asm = 1;
+        set_func_name( "mbtree_propagate_list" );
+        for( int i = 0; i < 10; i++ )
+        {
+            int16_t (*mvs)[2] = (int16_t(*)[2])buf1;
+            int *amount = (int*)buf2;
+            uint16_t *lowres_costs = (uint16_t*)buf4;
+            uint16_t *refc = (uint16_t*)buf3;
+            uint16_t *refa = refc + 100;
+            int list = i&1;
+            int bipred_weight = rand()%65;
+            int mb_y = rand()%h->mb.i_mb_height;
+            for( int j = 0; j < 16; j++ )
+            {
+                /* up to 4 mbs in any direction, so that some mvs point off the frame */
+                mvs[j][0] = rand()%257 - 128;
+                mvs[j][1] = rand()%257 - 128;
+                if( !(rand()&3) )
+                    M32( mvs[j] ) = 0;
+                amount[j] = (rand()&0x7fff) - 0x400;
+                lowres_costs[j] = ((rand()%3 + 1) << LOWRES_COST_SHIFT) + (rand()&LOWRES_COST_MASK);
+            }
+            for( int j = 0; j < 100; j++ )
+                refc[j] = refa[j] = rand();
+            call_c( mc_c.mbtree_propagate_list, h, refc, mvs, amount, lowres_costs, bipred_weight, mb_y, 13, list );
+            call_a( mc_a.mbtree_propagate_list, h, refa, mvs, amount, lowres_costs, bipred_weight, mb_y, 13, list );
+            if( memcmp( refc, refa, 100*sizeof(uint16_t) ) )
+            {
+                ok = 0;
+                fprintf( stderr, "mbtree_propagate_list [FAILED]\n" );
+                break;
+            }
+        }
+        report( "mbtree propagate list :" );
+    }
+
     return ret;
 }
 
@@ -2060,6 +2109,8 @@ static int check_all_flags( void )
     }
     if( x264_cpu_detect() & X264_CPU_AVX )
         ret |= add_flags( &cpu0, &cpu1, X264_CPU_AVX, "AVX" );
+    if( x264_cpu_detect() & X264_CPU_AVX2 )
+        ret |= add_flags( &cpu0, &cpu1, X264_CPU_AVX2, "AVX2" );
 #elif ARCH_PPC
     if( x264_cpu_detect() & X264_CPU_ALTIVEC )
     {
@@ -0,0 +1,181 @@
+#!/usr/bin/env python
+#
+# Sanity checker for x264's MPEG-2 transport stream output.
+#
+# Verifies packet sync, continuity counters, PAT/PMT sections and CRCs and
+# PES timestamps (dts monotonic, pts >= dts, pcr never after dts), then prints
+# a per-stream summary.  With -e, the elementary stream is written out so that
+# it can be compared against a raw .264 encode with the same settings.
+#
+# usage: tscheck.py [-e out.264] file.ts
+
+import struct
+import sys
+from optparse import OptionParser
+
+TS_PACKET_SIZE = 188
+
+def crc32_mpeg(data):
+    crc = 0xffffffff
+    for b in bytearray(data):
+        crc ^= b << 24
+        for i in range(8):
+            crc = ((crc << 1) ^ (0x04c11db7 if crc & 0x80000000 else 0)) & 0xffffffff
+    return crc
+
+def read_timestamp(p):
+    return ((p[0] >> 1) & 7) << 30 | p[1] << 22 | (p[2] >> 1) << 15 | p[3] << 7 | p[4] >> 1
+
+class CheckError(Exception):
+    pass
+
+class TsChecker(object):
+    def __init__(self, es_out=None):
+        self.cc = {}
+        self.pmt_pid = None
+        self.es_pids = {}
+        self.pcr_pid = None
+        self.es_out = es_out
+        self.last_pcr = None
+        self.last_dts = None
+        self.frames = 0
+        self.keyframes = 0
+        self.psi = 0
+        self.packets = 0
+        self.max_delay = 0
+
+    def fail(self, msg):
+        raise CheckError("packet %d: %s" % (self.packets, msg))
+
+    def section(self, pid, payload):
+        pointer = payload[0]
+        sec = payload[1 + pointer:]
+        length = ((sec[1] & 0xf) << 8) | sec[2]
+        sec = sec[:3 + length]
+        if crc32_mpeg(bytes(sec[:-4])) != struct.unpack(">I", bytes(sec[-4:]))[0]:
+            self.fail("bad crc in section on pid 0x%x" % pid)
+        self.psi += 1
+        if pid == 0:
+            if sec[0] != 0:
+                self.fail("pat has table id %d" % sec[0])
+            for i in range(8, 3 + length - 4, 4):
+                program = (sec[i] << 8) | sec[i + 1]
+                if program:
+                    self.pmt_pid = ((sec[i + 2] & 0x1f) << 8) | sec[i + 3]
+        elif pid == self.pmt_pid:
+            if sec[0] != 2:
+                self.fail("pmt has table id %d" % sec[0])
+            self.pcr_pid = ((sec[8] & 0x1f) << 8) | sec[9]
+            info_len = ((sec[10] & 0xf) << 8) | sec[11]
+            i = 12 + info_len
+            while i < 3 + length - 4:
+                stream_type = sec[i]
+                es_pid = ((sec[i + 1] & 0x1f) << 8) | sec[i + 2]
+                self.es_pids[es_pid] = stream_type
+                i += 5 + (((sec[i + 3] & 0xf) << 8) | sec[i + 4])
+
+    def pes(self, payload, pcr, random_access):
+        if payload[0:3] != bytearray(b"\x00\x00\x01"):
+            self.fail("missing pes start code")
+        flags = payload[7]
+        hdr_len = payload[8]
+        pts = dts = None
+        if flags & 0x80:
+            pts = dts = read_timestamp(payload[9:14])
+        if flags & 0x40:
+            dts = read_timestamp(payload[14:19])
+        if pts is None:
+            self.fail("pes without pts")
+        if pts < dts:
+            self.fail("pts %d < dts %d" % (pts, dts))
+        if self.last_dts is not None and dts <= self.last_dts:
+            self.fail("non-monotonic dts %d after %d" % (dts, self.last_dts))
+        if pcr is not None:
+            if pcr > dts * 300:
+                self.fail("pcr %d after dts %d" % (pcr, dts * 300))
+            self.max_delay = max(self.max_delay, dts * 300 - pcr)
+        self.last_dts = dts
+        self.frames += 1
+        self.keyframes += random_access
+        return payload[9 + hdr_len:]
+
+    def packet(self, pkt):
+        if pkt[0] != 0x47:
+            self.fail("lost sync")
+        pusi = pkt[1] & 0x40
+        pid = ((pkt[1] & 0x1f) << 8) | pkt[2]
+        afc = (pkt[3] >> 4) & 3
+        cc = pkt[3] & 0xf
+        if afc & 1:
+            if pid in self.cc and cc != (self.cc[pid] + 1) & 0xf:
+                self.fail("continuity error on pid 0x%x" % pid)
+            self.cc[pid] = cc
+        pos = 4
+        pcr = None
+        random_access = 0
+        if afc & 2:
+            af_len = pkt[4]
+            if af_len:
+                random_access = (pkt[5] >> 6) & 1
+                if pkt[5] & 0x10:
+                    base = (pkt[6] << 25) | (pkt[7] << 17) | (pkt[8] << 9) | (pkt[9] << 1) | (pkt[10] >> 7)
+                    pcr = base * 300 + (((pkt[10] & 1) << 8) | pkt[11])
+                    if pid != self.pcr_pid:
+                        self.fail("pcr on pid 0x%x" % pid)
+                    if self.last_pcr is not None and pcr < self.last_pcr:
+                        self.fail("pcr went backwards")
+                    self.last_pcr = pcr
+            pos += 1 + af_len
+        if not afc & 1:
+            return
+        payload = pkt[pos:]
+        if pid == 0 or pid == self.pmt_pid:
+            if pusi:
+                self.section(pid, payload)
+        elif pid in self.es_pids:
+            if pusi:
+                payload = self.pes(payload, pcr, random_access)
+            elif not self.frames:
+                self.fail("es data before the first pes header")
+            if self.es_out:
+                self.es_out.write(bytes(payload))
+        else:
+            self.fail("packet on unknown pid 0x%x" % pid)
+
+    def run(self, f):
+        while True:
+            pkt = f.read(TS_PACKET_SIZE)
+            if not pkt:
+                break
+            if len(pkt) != TS_PACKET_SIZE:
+                self.fail("truncated packet")
+            self.packet(bytearray(pkt))
+            self.packets += 1
+
+def main():
+    parser = OptionParser(usage="%prog [-e out.264] file.ts")
+    parser.add_option("-e", "--es", dest="es", help="write the video elementary stream to FILE", metavar="FILE")
+    options, args = parser.parse_args()
+    if len(args) != 1:
+        parser.error("expected one input file")
+
+    es_out = open(options.es, "wb") if options.es else None
+    checker = TsChecker(es_out)
+    try:
+        checker.run(open(args[0], "rb"))
+    except CheckError as e:
+        sys.stderr.write("%s: %s\n" % (args[0], e))
+        return 1
+    finally:
+        if es_out:
+            es_out.close()
+
+    for pid, stream_type in sorted(checker.es_pids.items()):
+        print("pid 0x%04x: stream type 0x%02x%s" % (pid, stream_type, " (pcr)" if pid == checker.pcr_pid else ""))
+    print("packets: %d, psi sections: %d, frames: %d, random access points: %d" %
+          (checker.packets, checker.psi, checker.frames, checker.keyframes))
+    print("max pcr to dts delay: %.3f s" % (checker.max_delay / 27e6))
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
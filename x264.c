@@ -74,18 +74,20 @@ static char UNUSED originalCTitle[200] = "";
 
 typedef struct {
     int b_progress;
+    int b_thread_output;
     int i_seek;
     hnd_t hin;
     hnd_t hout;
     FILE *qpfile;
     FILE *tcfile_out;
+    FILE *timing_out;
     double timebase_convert_multiplier;
     int i_pulldown;
 } cli_opt_t;
 
 /* file i/o operation structs */
 cli_input_t input;
-static cli_output_t output;
+cli_output_t output;
 
 /* video filter operation struct */
 static cli_vid_filter_t filter;
@@ -113,6 +115,8 @@ static const char * const muxer_names[] =
     "raw",
     "mkv",
     "flv",
+    "fmp4",
+    "ts",
 #if HAVE_GPAC
     "mp4",
 #endif
@@ -233,7 +237,10 @@ static void print_version_info()
 #else
     printf( "using an unknown compiler\n" );
 #endif
-    printf( "configuration: --bit-depth=%d\n", x264_bit_depth );
+    if( x264_bit_depth )
+        printf( "configuration: --bit-depth=%d\n", x264_bit_depth );
+    else
+        printf( "configuration: --bit-depth=all\n" );
     printf( "x264 license: " );
 #if HAVE_GPL
     printf( "GPL version 2 or later\n" );
@@ -287,6 +294,8 @@ int main( int argc, char **argv )
         output.close_file( opt.hout, 0, 0 );
     if( opt.tcfile_out )
         fclose( opt.tcfile_out );
+    if( opt.timing_out )
+        fclose( opt.timing_out );
     if( opt.qpfile )
         fclose( opt.qpfile );
 
@@ -356,6 +365,13 @@ static void print_csp_names( int longhelp )
 static void help( x264_param_t *defaults, int longhelp )
 {
     char buf[50];
+    char depth_desc[40];
+    if( x264_bit_depth )
+        sprintf( depth_desc, "%d (configured at compile time)", x264_bit_depth );
+    else
+        strcpy( depth_desc, "8 or 10, see --output-depth" );
+    /* QP_MAX of the default output depth */
+    int qp_max = 51 + 6*(defaults->i_bitdepth-8) + 18;
 #define H0 printf
 #define H1 if(longhelp>=1) printf
 #define H2 if(longhelp==2) printf
@@ -370,8 +386,11 @@ static void help( x264_param_t *defaults, int longhelp )
         " .264 -> Raw bytestream\n"
         " .mkv -> Matroska\n"
         " .flv -> Flash Video\n"
-        " .mp4 -> MP4 if compiled with GPAC support (%s)\n"
-        "Output bit depth: %d (configured at compile time)\n"
+        " .mp4 -> MP4 if compiled with GPAC support (%s),\n"
+        "         otherwise fragmented MP4\n"
+        " .cmfv -> Fragmented MP4 (CMAF)\n"
+        " .ts -> MPEG-2 Transport Stream\n"
+        "Output bit depth: %s\n"
         "\n"
         "Options:\n"
         "\n"
@@ -400,7 +419,7 @@ static void help( x264_param_t *defaults, int longhelp )
 #else
         "no",
 #endif
-        x264_bit_depth
+        depth_desc
       );
     H0( "Example usage:\n" );
     H0( "\n" );
@@ -571,17 +590,21 @@ static void help( x264_param_t *defaults, int longhelp )
     H0( "\n" );
     H0( "Ratecontrol:\n" );
     H0( "\n" );
-    H1( "  -q, --qp <integer>          Force constant QP (0-%d, 0=lossless)\n", QP_MAX );
+    H1( "  -q, --qp <integer>          Force constant QP (0-%d, 0=lossless)\n", qp_max );
     H0( "  -B, --bitrate <integer>     Set bitrate (kbit/s)\n" );
-    H0( "      --crf <float>           Quality-based VBR (%d-51) [%.1f]\n", 51 - QP_MAX_SPEC, defaults->rc.f_rf_constant );
+    H0( "      --crf <float>           Quality-based VBR (%d-51) [%.1f]\n", -6*(defaults->i_bitdepth-8), defaults->rc.f_rf_constant );
     H1( "      --rc-lookahead <integer> Number of frames for frametype lookahead [%d]\n", defaults->rc.i_lookahead );
+    H2( "      --lookahead-pyramid <integer> Coarse levels for lookahead motion search [%d]\n"
+        "                                  - 0: off, search the half-size frames only\n"
+        "                                  - 1: start from quarter-size frames\n"
+        "                                  - 2: start from eighth-size frames\n", defaults->rc.i_lookahead_pyramid );
     H0( "      --vbv-maxrate <integer> Max local bitrate (kbit/s) [%d]\n", defaults->rc.i_vbv_max_bitrate );
     H0( "      --vbv-bufsize <integer> Set size of the VBV buffer (kbit) [%d]\n", defaults->rc.i_vbv_buffer_size );
     H2( "      --vbv-init <float>      Initial VBV buffer occupancy [%.1f]\n", defaults->rc.f_vbv_buffer_init );
     H2( "      --crf-max <float>       With CRF+VBV, limit RF to this value\n"
         "                                  May cause VBV underflows!\n" );
     H2( "      --qpmin <integer>       Set min QP [%d]\n", defaults->rc.i_qp_min );
-    H2( "      --qpmax <integer>       Set max QP [%d]\n", defaults->rc.i_qp_max );
+    H2( "      --qpmax <integer>       Set max QP [%d]\n", X264_MIN( defaults->rc.i_qp_max, qp_max ) );
     H2( "      --qpstep <integer>      Set max QP step [%d]\n", defaults->rc.i_qp_step );
     H2( "      --ratetol <float>       Tolerance of ABR ratecontrol and VBV [%.1f]\n", defaults->rc.f_rate_tolerance );
     H2( "      --ipratio <float>       QP factor between I and P [%.2f]\n", defaults->rc.f_ip_factor );
@@ -724,6 +747,11 @@ static void help( x264_param_t *defaults, int longhelp )
     H0( "  -o, --output <string>       Specify output file\n" );
     H1( "      --muxer <string>        Specify output container format [\"%s\"]\n"
         "                                  - %s\n", muxer_names[0], stringify_names( buf, muxer_names ) );
+    H1( "      --segment <float>       Split the output into keyframe-aligned segments\n"
+        "                              of at least this many seconds, named\n"
+        "                              <output>-00000.<ext>, with an HLS playlist\n"
+        "                              <output>.m3u8 and an index <output>-index.csv\n"
+        "                                  - timestamps are continuous with ts and fmp4\n" );
     H1( "      --demuxer <string>      Specify input container format [\"%s\"]\n"
         "                                  - %s\n", demuxer_names[0], stringify_names( buf, demuxer_names ) );
     H1( "      --input-fmt <string>    Specify input file format (requires lavf support)\n" );
@@ -731,6 +759,8 @@ static void help( x264_param_t *defaults, int longhelp )
     print_csp_names( longhelp );
     H1( "      --input-depth <integer> Specify input bit depth for raw input\n" );
     H1( "      --input-res <intxint>   Specify input resolution (width x height)\n" );
+    if( !x264_bit_depth )
+        H1( "      --output-depth <integer> Specify output bit depth, 8 or 10 [%d]\n", defaults->i_bitdepth );
     H1( "      --index <string>        Filename for input index file\n" );
     H0( "      --sar width:height      Specify Sample Aspect Ratio\n" );
     H0( "      --fps <float|rational>  Specify framerate\n" );
@@ -750,12 +780,21 @@ static void help( x264_param_t *defaults, int longhelp )
     H1( "      --threads <integer>     Force a specific number of threads\n" );
     H2( "      --sliced-threads        Low-latency but lower-efficiency threading\n" );
     H2( "      --thread-input          Run Avisynth in its own thread\n" );
+    H2( "      --thread-output         Write the output file in its own thread\n" );
     H2( "      --sync-lookahead <integer> Number of buffer frames for threaded lookahead\n" );
+    H2( "      --lookahead-threads <integer> Number of threads for lookahead cost analysis\n" );
+    H2( "      --low-memory            Keep per-encoder buffers small; the default\n"
+        "                              sync-lookahead becomes 0\n" );
     H2( "      --non-deterministic     Slightly improve quality of SMP, at the cost of repeatability\n" );
     H2( "      --asm <integer>         Override CPU detection\n" );
     H2( "      --no-asm                Disable all CPU optimizations\n" );
     H2( "      --visualize             Show MB types overlayed on the encoded video\n" );
     H2( "      --dump-yuv <string>     Save reconstructed frames\n" );
+    H2( "      --frame-log <string>    Write type, QP, size, quality and timing of each frame\n" );
+    H2( "      --frame-log-format <string> Format of the frame log [\"%s\"]\n"
+        "                                  - %s\n", x264_frame_log_format_names[0], stringify_names( buf, x264_frame_log_format_names ) );
+    H2( "      --timing <string>       Write the time spent in each encoding stage as JSON\n"
+        "                                  Requires libx264 configured with --enable-timing\n" );
     H2( "      --sps-id <integer>      Set SPS and PPS id numbers [%d]\n", defaults->i_sps_id );
     H2( "      --aud                   Use access unit delimiters\n" );
     H2( "      --force-cfr             Force constant framerate timestamp generation\n" );
@@ -784,6 +823,7 @@ enum
     OPT_SEEK,
     OPT_QPFILE,
     OPT_THREAD_INPUT,
+    OPT_THREAD_OUTPUT,
     OPT_QUIET,
     OPT_NOPROGRESS,
     OPT_VISUALIZE,
@@ -808,7 +848,9 @@ enum
     OPT_INPUT_RES,
     OPT_INPUT_CSP,
     OPT_INPUT_DEPTH,
-    OPT_DTS_COMPRESSION
+    OPT_DTS_COMPRESSION,
+    OPT_SEGMENT,
+    OPT_TIMING
 } OptionsOPT;
 
 static char short_options[] = "8A:B:b:f:hI:i:m:o:p:q:r:t:Vvw";
@@ -852,6 +894,7 @@ static struct option long_options[] =
     { "qpstep",      required_argument, NULL, 0 },
     { "crf",         required_argument, NULL, 0 },
     { "rc-lookahead",required_argument, NULL, 0 },
+    { "lookahead-pyramid", required_argument, NULL, 0 },
     { "ref",         required_argument, NULL, 'r' },
     { "asm",         required_argument, NULL, 0 },
     { "no-asm",            no_argument, NULL, 0 },
@@ -917,7 +960,10 @@ static struct option long_options[] =
     { "slice-max-mbs",     required_argument, NULL, 0 },
     { "slices",            required_argument, NULL, 0 },
     { "thread-input",      no_argument, NULL, OPT_THREAD_INPUT },
+    { "thread-output",     no_argument, NULL, OPT_THREAD_OUTPUT },
     { "sync-lookahead",    required_argument, NULL, 0 },
+    { "low-memory",        no_argument, NULL, 0 },
+    { "lookahead-threads", required_argument, NULL, 0 },
     { "non-deterministic", no_argument, NULL, 0 },
     { "psnr",              no_argument, NULL, 0 },
     { "ssim",              no_argument, NULL, 0 },
@@ -927,6 +973,8 @@ static struct option long_options[] =
     { "no-progress",       no_argument, NULL, OPT_NOPROGRESS },
     { "visualize",         no_argument, NULL, OPT_VISUALIZE },
     { "dump-yuv",    required_argument, NULL, 0 },
+    { "frame-log",   required_argument, NULL, 0 },
+    { "frame-log-format", required_argument, NULL, 0 },
     { "sps-id",      required_argument, NULL, 0 },
     { "aud",               no_argument, NULL, 0 },
     { "nr",          required_argument, NULL, 0 },
@@ -965,7 +1013,10 @@ static struct option long_options[] =
     { "input-res",   required_argument, NULL, OPT_INPUT_RES },
     { "input-csp",   required_argument, NULL, OPT_INPUT_CSP },
     { "input-depth", required_argument, NULL, OPT_INPUT_DEPTH },
+    { "output-depth", required_argument, NULL, 0 },
     { "dts-compress",      no_argument, NULL, OPT_DTS_COMPRESSION },
+    { "segment",     required_argument, NULL, OPT_SEGMENT },
+    { "timing",      required_argument, NULL, OPT_TIMING },
     {0, 0, 0, 0}
 };
 
@@ -987,10 +1038,26 @@ static int select_output( const char *muxer, char *filename, x264_param_t *param
             param->i_nal_hrd = X264_NAL_HRD_VBR;
         }
 #else
-        x264_cli_log( "x264", X264_LOG_ERROR, "not compiled with MP4 output support\n" );
-        return -1;
+        output = fmp4_output;
+        param->b_annexb = 0;
+        param->b_repeat_headers = 0;
 #endif
     }
+    else if( !strcasecmp( ext, "fmp4" ) || !strcasecmp( ext, "cmfv" ) )
+    {
+        output = fmp4_output;
+        param->b_annexb = 0;
+        param->b_repeat_headers = 0;
+    }
+    else if( !strcasecmp( ext, "ts" ) )
+    {
+        /* h.264 in transport streams requires an access unit delimiter in every frame,
+         * and SPS/PPS after it at every keyframe so that receivers can join mid-stream */
+        output = ts_output;
+        param->b_annexb = 1;
+        param->b_aud = 1;
+        param->b_repeat_headers = 1;
+    }
     else if( !strcasecmp( ext, "mkv" ) )
     {
         output = mkv_output;
@@ -1129,7 +1196,7 @@ static int init_vid_filters( char *sequence, hnd_t *handle, video_info_t *info,
         return -1;
 
     char args[20];
-    sprintf( args, "bit_depth=%d", x264_bit_depth );
+    sprintf( args, "bit_depth=%d", param->i_bitdepth );
 
     if( x264_init_vid_filter( "depth", handle, &filter, info, param, args ) )
         return -1;
@@ -1170,6 +1237,7 @@ static int parse( int argc, char **argv, x264_param_t *param, cli_opt_t *opt )
     char *profile = NULL;
     char *vid_filters = NULL;
     int b_thread_input = 0;
+    int b_thread_output = 0;
     int b_turbo = 1;
     int b_user_ref = 0;
     int b_user_fps = 0;
@@ -1265,6 +1333,9 @@ static int parse( int argc, char **argv, x264_param_t *param, cli_opt_t *opt )
             case OPT_THREAD_INPUT:
                 b_thread_input = 1;
                 break;
+            case OPT_THREAD_OUTPUT:
+                b_thread_output = 1;
+                break;
             case OPT_QUIET:
                 cli_log_level = param->i_log_level = X264_LOG_NONE;
                 break;
@@ -1339,6 +1410,14 @@ static int parse( int argc, char **argv, x264_param_t *param, cli_opt_t *opt )
             case OPT_DTS_COMPRESSION:
                 output_opt.use_dts_compress = 1;
                 break;
+            case OPT_SEGMENT:
+                output_opt.segment_duration = atof( optarg );
+                FAIL_IF_ERROR( output_opt.segment_duration <= 0, "invalid segment duration: %s\n", optarg )
+                break;
+            case OPT_TIMING:
+                opt->timing_out = fopen( optarg, "wb" );
+                FAIL_IF_ERROR( !opt->timing_out, "can't open `%s'\n", optarg )
+                break;
             default:
 generic_option:
             {
@@ -1383,7 +1462,22 @@ generic_option:
 
     if( select_output( muxer, output_filename, param ) )
         return -1;
-    FAIL_IF_ERROR( output.open_file( output_filename, &opt->hout, &output_opt ), "could not open output file `%s'\n", output_filename )
+    if( output_opt.segment_duration > 0 )
+    {
+        FAIL_IF_ERROR( !strcmp( output_filename, "-" ), "segmented output requires an output filename\n" )
+        FAIL_IF_ERROR( segment_output.open_file( output_filename, &opt->hout, &output_opt ), "could not open segmented output `%s'\n", output_filename )
+        output = segment_output;
+    }
+    else
+        FAIL_IF_ERROR( output.open_file( output_filename, &opt->hout, &output_opt ), "could not open output file `%s'\n", output_filename )
+#if HAVE_THREAD
+    if( b_thread_output )
+    {
+        FAIL_IF_ERROR( thread_output.open_file( NULL, &opt->hout, &output_opt ), "threaded output failed\n" )
+        output = thread_output;
+        opt->b_thread_output = 1;
+    }
+#endif
 
     input_filename = argv[optind++];
     video_info_t info = {0};
@@ -1524,8 +1618,10 @@ generic_option:
     return 0;
 }
 
-static void parse_qpfile( cli_opt_t *opt, x264_picture_t *pic, int i_frame )
+static void parse_qpfile( cli_opt_t *opt, x264_picture_t *pic, int i_frame, int bit_depth )
 {
+    /* QP_MAX of the output depth: the CLI is built at 8 bits with --bit-depth=all */
+    int qp_max = 51 + 6*(bit_depth-8) + 18;
     int num = -1, qp, ret;
     char type;
     uint64_t file_pos;
@@ -1552,7 +1648,7 @@ static void parse_qpfile( cli_opt_t *opt, x264_picture_t *pic, int i_frame )
         else if( type == 'B' ) pic->i_type = X264_TYPE_BREF;
         else if( type == 'b' ) pic->i_type = X264_TYPE_B;
         else ret = 0;
-        if( ret < 2 || qp < -1 || qp > QP_MAX )
+        if( ret < 2 || qp < -1 || qp > qp_max )
         {
             x264_cli_log( "x264", X264_LOG_ERROR, "can't parse qpfile for frame %d\n", i_frame );
             fclose( opt->qpfile );
@@ -1582,7 +1678,7 @@ static int encode_frame( x264_t *h, hnd_t hout, x264_picture_t *pic, int64_t *la
     return i_frame_size;
 }
 
-static int64_t print_status( int64_t i_start, int64_t i_previous, int i_frame, int i_frame_total, int64_t i_file, x264_param_t *param, int64_t last_ts )
+static int64_t print_status( int64_t i_start, int64_t i_previous, int i_frame, int i_frame_total, int64_t i_file, x264_param_t *param, int64_t last_ts, int64_t i_stall )
 {
     char buf[200];
     int64_t i_time = x264_mdate();
@@ -1606,12 +1702,24 @@ static int64_t print_status( int64_t i_start, int64_t i_previous, int i_frame, i
     {
         sprintf( buf, "x264 %d frames: %.2f fps, %.2f kb/s", i_frame, fps, bitrate );
     }
+    /* time spent waiting on the threaded muxer, negative when it isn't used */
+    if( i_stall >= 0 )
+        sprintf( buf + strlen( buf ), ", stall %.1fs", i_stall / 1e6 );
     fprintf( stderr, "%s  \r", buf+5 );
     SetConsoleTitle( buf );
     fflush( stderr ); // needed in windows
     return i_time;
 }
 
+static int64_t output_stall( cli_opt_t *opt )
+{
+#if HAVE_THREAD
+    if( opt->b_thread_output )
+        return thread_output_stall( opt->hout );
+#endif
+    return -1;
+}
+
 static void convert_cli_to_lib_pic( x264_picture_t *lib, cli_pic_t *cli )
 {
     memcpy( lib->img.i_stride, cli->img.stride, sizeof(cli->img.stride) );
@@ -1629,6 +1737,16 @@ if( cond )\
     goto fail;\
 }
 
+static void write_timing( FILE *f, x264_timing_t *timing, int frames, int64_t elapsed )
+{
+    fprintf( f, "{\n  \"frames\": %d,\n  \"elapsed\": %.6f,\n  \"fps\": %.3f,\n  \"stages\": {\n",
+             frames, elapsed / 1e6, elapsed > 0 ? frames * 1e6 / elapsed : 0. );
+    for( int i = 0; i < X264_TIMING_MAX; i++ )
+        fprintf( f, "    \"%s\": { \"seconds\": %.6f, \"count\": %"PRId64" }%s\n", x264_timing_names[i],
+                 timing->i_time[i] / 1e6, timing->i_count[i], i < X264_TIMING_MAX-1 ? "," : "" );
+    fprintf( f, "  }\n}\n" );
+}
+
 static int encode( x264_param_t *param, cli_opt_t *opt )
 {
     x264_t *h = NULL;
@@ -1731,7 +1849,7 @@ static int encode( x264_param_t *param, cli_opt_t *opt )
             fprintf( opt->tcfile_out, "%.6f\n", pic.i_pts * ((double)param->i_timebase_num / param->i_timebase_den) * 1e3 );
 
         if( opt->qpfile )
-            parse_qpfile( opt, &pic, i_frame + opt->i_seek );
+            parse_qpfile( opt, &pic, i_frame + opt->i_seek, param->i_bitdepth );
 
         prev_dts = last_dts;
         i_frame_size = encode_frame( h, opt->hout, &pic, &last_dts );
@@ -1753,7 +1871,7 @@ static int encode( x264_param_t *param, cli_opt_t *opt )
 
         /* update status line (up to 1000 times per input file) */
         if( opt->b_progress && i_frame_output )
-            i_previous = print_status( i_start, i_previous, i_frame_output, param->i_frame_total, i_file, param, 2 * last_dts - prev_dts - first_dts );
+            i_previous = print_status( i_start, i_previous, i_frame_output, param->i_frame_total, i_file, param, 2 * last_dts - prev_dts - first_dts, output_stall( opt ) );
     }
     /* Flush delayed frames */
     while( !b_ctrl_c && x264_encoder_delayed_frames( h ) )
@@ -1773,7 +1891,7 @@ static int encode( x264_param_t *param, cli_opt_t *opt )
                 first_dts = prev_dts = last_dts;
         }
         if( opt->b_progress && i_frame_output )
-            i_previous = print_status( i_start, i_previous, i_frame_output, param->i_frame_total, i_file, param, 2 * last_dts - prev_dts - first_dts );
+            i_previous = print_status( i_start, i_previous, i_frame_output, param->i_frame_total, i_file, param, 2 * last_dts - prev_dts - first_dts, output_stall( opt ) );
     }
 fail:
     if( pts_warning_cnt >= MAX_PTS_WARNING && cli_log_level < X264_LOG_DEBUG )
@@ -1791,8 +1909,21 @@ fail:
     /* Erase progress indicator before printing encoding stats. */
     if( opt->b_progress )
         fprintf( stderr, "                                                                               \r" );
+    x264_timing_t timing;
+    int b_timing = 0;
+    if( h && opt->timing_out )
+    {
+        b_timing = !x264_encoder_timing( h, &timing );
+        if( !b_timing )
+            x264_cli_log( "x264", X264_LOG_WARNING, "--timing ignored: libx264 was built without --enable-timing\n" );
+    }
     if( h )
+    {
+        int64_t peak;
+        x264_memory_usage( &peak );
+        x264_cli_log( "x264", X264_LOG_DEBUG, "peak allocated memory: %.1f MB\n", peak / 1048576. );
         x264_encoder_close( h );
+    }
     fprintf( stderr, "\n" );
 
     if( b_ctrl_c )
@@ -1808,6 +1939,9 @@ fail:
 
         fprintf( stderr, "encoded %d frames, %.2f fps, %.2f kb/s\n", i_frame_output, fps,
                  (double) i_file * 8 / ( 1000 * duration ) );
+
+        if( b_timing )
+            write_timing( opt->timing_out, &timing, i_frame_output, i_end - i_start );
     }
 
     return retval;
@@ -41,7 +41,7 @@
 
 #include "x264_config.h"
 
-#define X264_BUILD 115
+#define X264_BUILD 121
 
 /* x264_t:
  *      opaque handler for encoder */
@@ -124,6 +124,7 @@ typedef struct
 #define X264_CPU_SLOW_ATOM      0x200000  /* The Atom just sucks */
 #define X264_CPU_AVX            0x400000  /* AVX support: requires OS support even if YMM registers
                                            * aren't used. */
+#define X264_CPU_AVX2           0x800000  /* AVX2 support: 256-bit integer SIMD, requires OS support as AVX */
 
 /* Analyse flags
  */
@@ -173,6 +174,7 @@ static const char * const x264_colorprim_names[] = { "", "bt709", "undef", "", "
 static const char * const x264_transfer_names[] = { "", "bt709", "undef", "", "bt470m", "bt470bg", "smpte170m", "smpte240m", "linear", "log100", "log316", 0 };
 static const char * const x264_colmatrix_names[] = { "GBR", "bt709", "undef", "", "fcc", "bt470bg", "smpte170m", "smpte240m", "YCgCo", 0 };
 static const char * const x264_nal_hrd_names[] = { "none", "vbr", "cbr", 0 };
+static const char * const x264_frame_log_format_names[] = { "csv", "json", 0 };
 
 /* Colorspace type */
 #define X264_CSP_MASK           0x00ff  /* */
@@ -211,6 +213,9 @@ static const char * const x264_nal_hrd_names[] = { "none", "vbr", "cbr", 0 };
 #define X264_NAL_HRD_VBR             1
 #define X264_NAL_HRD_CBR             2
 
+#define X264_FRAME_LOG_CSV           0
+#define X264_FRAME_LOG_JSON          1 /* one object per line */
+
 /* Zones: override ratecontrol or other options for specific sections of the video.
  * See x264_encoder_reconfig() for which options can be changed.
  * If zones overlap, whichever comes later in the list takes precedence. */
@@ -231,11 +236,14 @@ typedef struct x264_param_t
     int         b_sliced_threads;  /* Whether to use slice-based threading. */
     int         b_deterministic; /* whether to allow non-deterministic optimizations when threaded */
     int         i_sync_lookahead; /* threaded lookahead buffer */
+    int         i_lookahead_threads; /* helper threads for lowres cost analysis; doesn't change the output */
+    int         b_low_memory; /* keep per-encoder buffers small, for many encoders in one process; doesn't change the output */
 
     /* Video Properties */
     int         i_width;
     int         i_height;
     int         i_csp;  /* CSP of encoded bitstream, only i420 supported */
+    int         i_bitdepth; /* bit depth of the encoded bitstream, see x264_bit_depth */
     int         i_level_idc;
     int         i_frame_total; /* number of frames to encode if known, else 0 */
 
@@ -305,6 +313,8 @@ typedef struct x264_param_t
     int         i_log_level;
     int         b_visualize;
     char        *psz_dump_yuv;  /* filename for reconstructed frames */
+    char        *psz_frame_log; /* filename for per-frame statistics */
+    int         i_frame_log_format; /* X264_FRAME_LOG_* */
 
     /* Encoder analyser parameters */
     struct
@@ -345,9 +355,9 @@ typedef struct x264_param_t
     {
         int         i_rc_method;    /* X264_RC_* */
 
-        int         i_qp_constant;  /* 0 to (51 + 6*(x264_bit_depth-8)). 0=lossless */
+        int         i_qp_constant;  /* 0 to (51 + 6*(i_bitdepth-8)). 0=lossless, -1=the equivalent of 23 at 8 bits */
         int         i_qp_min;       /* min allowed QP value */
-        int         i_qp_max;       /* max allowed QP value */
+        int         i_qp_max;       /* max allowed QP value, clipped to the bit depth's maximum */
         int         i_qp_step;      /* max QP step between frames */
 
         int         i_bitrate;
@@ -364,6 +374,7 @@ typedef struct x264_param_t
         float       f_aq_strength;
         int         b_mb_tree;      /* Macroblock-tree ratecontrol. */
         int         i_lookahead;
+        int         i_lookahead_pyramid; /* coarse levels (quarter, eighth size) seeding the half-size lookahead motion search */
 
         /* 2pass */
         int         b_stat_write;   /* Enable stat writing in psz_stat_out */
@@ -592,7 +603,10 @@ int     x264_param_apply_profile( x264_param_t *, const char *profile );
  *      two bytes of input data for each pixel sample, and expect the upper
  *      (16-x264_bit_depth) bits to be zero.
  *      Note: The flag X264_CSP_HIGH_DEPTH must be used to specify the
- *      colorspace depth as well. */
+ *      colorspace depth as well.
+ *      If x264 was configured with --bit-depth=all, this is 0 and the depth
+ *      (8 or 10) is chosen per encoder by x264_param_t.i_bitdepth; otherwise
+ *      i_bitdepth must equal x264_bit_depth. */
 extern const int x264_bit_depth;
 
 enum pic_struct_e
@@ -723,6 +737,14 @@ int x264_picture_alloc( x264_picture_t *pic, int i_csp, int i_width, int i_heigh
  *  x264_picture_alloc ONLY */
 void x264_picture_clean( x264_picture_t *pic );
 
+/* x264_memory_usage:
+ *      returns the number of bytes currently allocated by libx264 and, if peak is
+ *      non-NULL, stores the most that was allocated at any one time.
+ *      The counters cover the whole process, not a single encoder: with several
+ *      encoders (or other users of libx264) in one process, they report the sum
+ *      and can't be attributed to any one of them. */
+int64_t x264_memory_usage( int64_t *peak );
+
 /****************************************************************************
  * Encoder functions
  ****************************************************************************/
@@ -815,4 +837,33 @@ void    x264_encoder_intra_refresh( x264_t * );
  *      Returns 0 on success, negative on failure. */
 int x264_encoder_invalidate_reference( x264_t *, int64_t pts );
 
+/* Stages timed by x264_encoder_timing */
+#define X264_TIMING_SLICETYPE       0 /* lookahead frame type and mbtree decisions */
+#define X264_TIMING_ANALYSE         1 /* macroblock mode decision and motion search */
+#define X264_TIMING_ENCODE          2 /* transform, quantization and reconstruction */
+#define X264_TIMING_BITSTREAM       3 /* cabac/cavlc macroblock writing */
+#define X264_TIMING_FILTER          4 /* deblocking, border expansion and hpel of finished rows */
+#define X264_TIMING_METRICS         5 /* psnr and ssim measurement */
+#define X264_TIMING_WAIT_REF        6 /* frame threads waiting for reference frame rows, part of analyse */
+#define X264_TIMING_WAIT_LOOKAHEAD  7 /* waiting for the lookahead thread to decide frames */
+#define X264_TIMING_MAX             8
+static const char * const x264_timing_names[] = { "slicetype", "analyse", "encode", "bitstream", "filter", "metrics",
+                                                  "wait_ref", "wait_lookahead", 0 };
+
+typedef struct
+{
+    int64_t i_time[X264_TIMING_MAX];  /* microseconds, summed over all encoder threads */
+    int64_t i_count[X264_TIMING_MAX]; /* number of timed intervals */
+} x264_timing_t;
+
+/* x264_encoder_timing:
+ *      Fill timing with the time spent in each encoding stage since x264_encoder_open.
+ *      Stages running in different threads overlap, so the sum can exceed the wall time.
+ *
+ *      Only available if libx264 was configured with --enable-timing, otherwise the counters
+ *      are zeroed and -1 is returned.
+ *
+ *      Should not be called during an x264_encoder_encode. */
+int x264_encoder_timing( x264_t *, x264_timing_t *timing );
+
 #endif